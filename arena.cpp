@@ -0,0 +1,63 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#include "arena.h"
+
+
+TArena::TArena(std::size_t blockSize)
+    : BlockSize(blockSize)
+{
+}
+
+TArena::~TArena() {
+    FreeBlocks();
+}
+
+void *TArena::Allocate(std::size_t size, std::size_t alignment) {
+    std::uintptr_t address = (reinterpret_cast<std::uintptr_t>(Current) + alignment - 1) & ~(alignment - 1);
+    if (!Current || address + size > reinterpret_cast<std::uintptr_t>(End)) {
+        AddBlock(std::max(BlockSize, size + alignment));
+        address = (reinterpret_cast<std::uintptr_t>(Current) + alignment - 1) & ~(alignment - 1);
+    }
+    Current = reinterpret_cast<char *>(address + size);
+    return reinterpret_cast<void *>(address);
+}
+
+void TArena::Reset() {
+    if (Blocks && Blocks->Next) {
+        std::size_t total = 0;
+        for (TBlock *block = Blocks; block; block = block->Next)
+            total += block->Size;
+        FreeBlocks();
+        AddBlock(total);
+        return;
+    }
+    if (Blocks) {
+        Current = reinterpret_cast<char *>(Blocks + 1);
+        End = Current + Blocks->Size;
+    }
+}
+
+void TArena::AddBlock(std::size_t size) {
+    void *memory = malloc(sizeof(TBlock) + size);
+    if (!memory)
+        throw std::bad_alloc();
+    TBlock *block = static_cast<TBlock *>(memory);
+    block->Next = Blocks;
+    block->Size = size;
+    Blocks = block;
+    Current = reinterpret_cast<char *>(block + 1);
+    End = Current + size;
+}
+
+void TArena::FreeBlocks() {
+    while (Blocks) {
+        TBlock *next = Blocks->Next;
+        free(Blocks);
+        Blocks = next;
+    }
+    Current = nullptr;
+    End = nullptr;
+}
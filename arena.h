@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+
+// Monotonic allocator for temporaries of one page of messages.
+// Allocation bumps a pointer, deallocation does nothing and Reset releases everything at once.
+// After a reset the blocks are coalesced into one, so a steady stream of pages stops calling malloc.
+class TArena {
+    public:
+        explicit TArena(std::size_t blockSize = 64 << 10);
+        ~TArena();
+
+        void *Allocate(std::size_t size, std::size_t alignment);
+        void Reset();
+
+    private:
+        struct TBlock {
+            TBlock *Next;
+            std::size_t Size;
+        };
+
+        std::size_t BlockSize;
+        TBlock *Blocks = nullptr;
+        char *Current = nullptr;
+        char *End = nullptr;
+
+        TArena(const TArena &) = delete;
+        TArena &operator = (const TArena &) = delete;
+        TArena(TArena &&) = delete;
+        TArena &&operator = (TArena &&) = delete;
+
+        void AddBlock(std::size_t size);
+        void FreeBlocks();
+};
+
+template <class T>
+class TArenaAllocator {
+    public:
+        using value_type = T;
+
+        TArenaAllocator(TArena &arena)
+            : Arena(&arena)
+        {
+        }
+
+        template <class U>
+        TArenaAllocator(const TArenaAllocator<U> &other)
+            : Arena(other.Arena)
+        {
+        }
+
+        T *allocate(std::size_t n) {
+            return static_cast<T *>(Arena->Allocate(n * sizeof(T), alignof(T)));
+        }
+
+        void deallocate(T *, std::size_t) {
+        }
+
+        template <class U>
+        bool operator == (const TArenaAllocator<U> &other) const {
+            return Arena == other.Arena;
+        }
+
+        template <class U>
+        bool operator != (const TArenaAllocator<U> &other) const {
+            return Arena != other.Arena;
+        }
+
+    private:
+        template <class U>
+        friend class TArenaAllocator;
+
+        TArena *Arena;
+};
+
+template <class T>
+using TArenaVector = std::vector<T, TArenaAllocator<T>>;
@@ -0,0 +1,448 @@
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "async_writer.h"
+#include "output_page.h"
+
+
+namespace {
+    const std::size_t WorkerCount = 2;
+}
+
+
+// Submission and completion rings shared with the kernel, set up with raw system calls
+struct TAsyncWriter::TUring {
+    int Fd = -1;
+    void *SqRing = MAP_FAILED;
+    void *CqRing = MAP_FAILED;
+    std::size_t SqRingSize = 0;
+    std::size_t CqRingSize = 0;
+    io_uring_sqe *Sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+    std::size_t SqesSize = 0;
+    unsigned *SqHead = nullptr;
+    unsigned *SqTail = nullptr;
+    unsigned *SqArray = nullptr;
+    unsigned SqMask = 0;
+    unsigned *CqHead = nullptr;
+    unsigned *CqTail = nullptr;
+    io_uring_cqe *Cqes = nullptr;
+    unsigned CqMask = 0;
+    unsigned Entries = 0;
+    unsigned ToSubmit = 0;
+    bool FixedBuffers = false;
+
+    ~TUring() {
+        if (Sqes != MAP_FAILED)
+            munmap(Sqes, SqesSize);
+        if (CqRing != MAP_FAILED && CqRing != SqRing)
+            munmap(CqRing, CqRingSize);
+        if (SqRing != MAP_FAILED)
+            munmap(SqRing, SqRingSize);
+        if (Fd >= 0)
+            close(Fd);
+    }
+
+    bool Setup(unsigned entries, char *buffers, std::size_t count, std::size_t size) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        Fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (Fd < 0)
+            return false;
+        // Streams are written at their current position, which needs 5.6
+        if (!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_RW_CUR_POS))
+            return false;
+        SqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        CqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+            SqRingSize = CqRingSize = std::max(SqRingSize, CqRingSize);
+        SqRing = mmap(nullptr, SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQ_RING);
+        if (SqRing == MAP_FAILED)
+            return false;
+        CqRing = single ? SqRing : mmap(nullptr, CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_CQ_RING);
+        if (CqRing == MAP_FAILED)
+            return false;
+        SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        Sqes = static_cast<io_uring_sqe *>(mmap(nullptr, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQES));
+        if (Sqes == MAP_FAILED)
+            return false;
+        char *sq = static_cast<char *>(SqRing);
+        SqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        SqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        SqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        SqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        char *cq = static_cast<char *>(CqRing);
+        CqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        CqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        Cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        CqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        Entries = params.sq_entries;
+        // Registration pins the pool, with a low RLIMIT_MEMLOCK plain writes from the same buffers are used
+        std::vector<iovec> vectors(count);
+        for (std::size_t i = 0; i < count; ++i)
+            vectors[i] = {buffers + i * size, size};
+        FixedBuffers = syscall(__NR_io_uring_register, Fd, IORING_REGISTER_BUFFERS, vectors.data(), static_cast<unsigned>(count)) == 0;
+        return true;
+    }
+
+    io_uring_sqe *NextSqe() {
+        while (*SqTail - __atomic_load_n(SqHead, __ATOMIC_ACQUIRE) == Entries)
+            Enter(0);
+        const unsigned index = *SqTail & SqMask;
+        io_uring_sqe *sqe = &Sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        SqArray[index] = index;
+        return sqe;
+    }
+
+    void Push() {
+        __atomic_store_n(SqTail, *SqTail + 1, __ATOMIC_RELEASE);
+        ++ToSubmit;
+    }
+
+    // Submits queued entries and waits for the given number of completions, returns 0 or an errno
+    int Enter(unsigned minComplete) {
+        for (;;) {
+            const long result = syscall(__NR_io_uring_enter, Fd, ToSubmit, minComplete, minComplete != 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (result >= 0) {
+                ToSubmit -= static_cast<unsigned>(result);
+                return 0;
+            }
+            if (errno != EINTR)
+                return errno;
+        }
+    }
+
+    void Drain(std::vector<TCompletion> &completions) {
+        unsigned head = *CqHead;
+        const unsigned tail = __atomic_load_n(CqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            const io_uring_cqe &cqe = Cqes[head & CqMask];
+            completions.push_back({static_cast<std::size_t>(cqe.user_data), cqe.res});
+        }
+        __atomic_store_n(CqHead, head, __ATOMIC_RELEASE);
+    }
+};
+
+
+TAsyncWriter::TAsyncWriter(std::size_t bufferCount, std::size_t bufferSize, std::size_t syncBytes)
+    : BufferSize(std::max<std::size_t>(bufferSize, 4096))
+    , SyncBytes(syncBytes)
+{
+    bufferCount = std::max<std::size_t>(bufferCount, 1);
+    void *memory = nullptr;
+    if (posix_memalign(&memory, 4096, bufferCount * BufferSize) != 0)
+        throw std::bad_alloc();
+    Buffers = static_cast<char *>(memory);
+    for (std::size_t i = bufferCount; i > 0; --i)
+        FreeBuffers.push_back(i - 1);
+    Uring = std::make_unique<TUring>();
+    if (!Uring->Setup(static_cast<unsigned>(bufferCount * 2), Buffers, bufferCount, BufferSize)) {
+        Uring.reset();
+        Workers.resize(WorkerCount);
+        for (std::size_t i = 0; i < Workers.size(); ++i)
+            Workers[i].Thread = std::thread(&TAsyncWriter::WorkerLoop, this, i);
+    }
+}
+
+TAsyncWriter::~TAsyncWriter() {
+    std::string error;
+    if (!Flush(error))
+        std::cerr << "Asynchronous output: " << error << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Stopping = true;
+    }
+    WorkCondition.notify_all();
+    for (auto &worker : Workers)
+        worker.Thread.join();
+    // The ring unregisters the buffers when it is closed, before they are freed
+    Uring.reset();
+    free(Buffers);
+}
+
+bool TAsyncWriter::IsUring() const {
+    return static_cast<bool>(Uring);
+}
+
+bool TAsyncWriter::Write(int fd, const char *data, std::size_t size, std::string &error) {
+    if (!Check(error))
+        return false;
+    Append(fd, data, size);
+    SubmitBuffer(fd);
+    Reap(false);
+    return Check(error);
+}
+
+bool TAsyncWriter::Write(int fd, const TOutputPage &page, std::string &error) {
+    if (!Check(error))
+        return false;
+    page.ForEachPart([this, fd](const char *data, std::size_t size) {
+        Append(fd, data, size);
+    });
+    SubmitBuffer(fd);
+    Reap(false);
+    return Check(error);
+}
+
+bool TAsyncWriter::Close(int fd, std::string &error) {
+    auto it = Files.find(fd);
+    if (it == Files.end()) {
+        close(fd);
+        return Check(error);
+    }
+    TFile &file = it->second;
+    if (file.Regular && file.UnsyncedBytes != 0) {
+        TOperation sync;
+        sync.Kind = EOperation::Sync;
+        sync.Fd = fd;
+        file.Queue.push_back(AddOperation(sync));
+        file.UnsyncedBytes = 0;
+    }
+    file.Closing = true;
+    SubmitQueued(fd, file);
+    Reap(false);
+    return Check(error);
+}
+
+bool TAsyncWriter::Pump(std::string &error) {
+    Reap(false);
+    return Check(error);
+}
+
+bool TAsyncWriter::Flush(std::string &error) {
+    for (auto &item : Files) {
+        TFile &file = item.second;
+        if (!file.Regular || file.UnsyncedBytes == 0)
+            continue;
+        TOperation sync;
+        sync.Kind = EOperation::Sync;
+        sync.Fd = item.first;
+        file.Queue.push_back(AddOperation(sync));
+        file.UnsyncedBytes = 0;
+    }
+    // Closing files erases them, so the queues are submitted over a copy of the descriptors
+    std::vector<int> fds;
+    for (const auto &item : Files)
+        fds.push_back(item.first);
+    for (int fd : fds)
+        SubmitQueued(fd, Files[fd]);
+    while (Pending != 0)
+        Reap(true);
+    // Positioned writes leave the file position where it was, so later plain writes and writers would overwrite them
+    for (const auto &item : Files) {
+        if (item.second.Regular && lseek(item.first, static_cast<off_t>(item.second.Offset), SEEK_SET) < 0 && Error.empty())
+            Error = std::string("Cannot seek: ") + strerror(errno);
+    }
+    Files.clear();
+    return Check(error);
+}
+
+TAsyncWriter::TFile &TAsyncWriter::GetFile(int fd) {
+    auto it = Files.find(fd);
+    if (it != Files.end())
+        return it->second;
+    TFile &file = Files[fd];
+    struct stat st;
+    file.Regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+    if (file.Regular)
+        file.Offset = std::max<std::int64_t>(lseek(fd, 0, SEEK_CUR), 0);
+    return file;
+}
+
+void TAsyncWriter::Append(int fd, const char *data, std::size_t size) {
+    while (size != 0) {
+        if (!HasOpenBuffer) {
+            // The only place which waits: every buffer is in flight
+            while (FreeBuffers.empty())
+                Reap(true);
+            OpenBuffer = FreeBuffers.back();
+            FreeBuffers.pop_back();
+            OpenBufferSize = 0;
+            HasOpenBuffer = true;
+        }
+        const std::size_t chunk = std::min(size, BufferSize - OpenBufferSize);
+        memcpy(Buffers + OpenBuffer * BufferSize + OpenBufferSize, data, chunk);
+        OpenBufferSize += chunk;
+        data += chunk;
+        size -= chunk;
+        if (OpenBufferSize == BufferSize)
+            SubmitBuffer(fd);
+    }
+}
+
+void TAsyncWriter::SubmitBuffer(int fd) {
+    if (!HasOpenBuffer)
+        return;
+    HasOpenBuffer = false;
+    TFile &file = GetFile(fd);
+    TOperation write;
+    write.Fd = fd;
+    write.Buffer = OpenBuffer;
+    write.Size = OpenBufferSize;
+    if (file.Regular) {
+        write.Offset = file.Offset;
+        file.Offset += static_cast<std::int64_t>(OpenBufferSize);
+        file.UnsyncedBytes += OpenBufferSize;
+    }
+    file.Queue.push_back(AddOperation(write));
+    if (file.Regular && SyncBytes != 0 && file.UnsyncedBytes >= SyncBytes) {
+        TOperation sync;
+        sync.Kind = EOperation::Sync;
+        sync.Fd = fd;
+        file.Queue.push_back(AddOperation(sync));
+        file.UnsyncedBytes = 0;
+    }
+    SubmitQueued(fd, file);
+}
+
+std::size_t TAsyncWriter::AddOperation(const TOperation &operation) {
+    ++Pending;
+    if (FreeOperations.empty()) {
+        Operations.push_back(operation);
+        return Operations.size() - 1;
+    }
+    const std::size_t index = FreeOperations.back();
+    FreeOperations.pop_back();
+    Operations[index] = operation;
+    return index;
+}
+
+void TAsyncWriter::SubmitQueued(int fd, TFile &file) {
+    // Writes into regular files may overlap, a stream gets one write at a time and a sync waits for the writes before it
+    while (!file.Queue.empty()) {
+        const std::size_t index = file.Queue.front();
+        const bool overlaps = Operations[index].Kind == EOperation::Write && file.Regular;
+        if (!overlaps && file.InFlight != 0)
+            break;
+        file.Queue.pop_front();
+        ++file.InFlight;
+        Submit(index);
+    }
+    if (file.Closing && file.Queue.empty() && file.InFlight == 0) {
+        close(fd);
+        Files.erase(fd);
+    }
+}
+
+void TAsyncWriter::Submit(std::size_t index) {
+    const TOperation &operation = Operations[index];
+    if (!Uring) {
+        {
+            std::lock_guard<std::mutex> lock(Mutex);
+            Workers[static_cast<std::size_t>(operation.Fd) % Workers.size()].Queue.emplace_back(index, operation);
+        }
+        WorkCondition.notify_all();
+        return;
+    }
+    io_uring_sqe *sqe = Uring->NextSqe();
+    if (operation.Kind == EOperation::Sync) {
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = operation.Fd;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    } else {
+        sqe->opcode = Uring->FixedBuffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = operation.Fd;
+        sqe->addr = reinterpret_cast<std::uint64_t>(Buffers + operation.Buffer * BufferSize + operation.Done);
+        sqe->len = static_cast<std::uint32_t>(operation.Size - operation.Done);
+        sqe->off = operation.Offset < 0 ? ~0ull : static_cast<std::uint64_t>(operation.Offset) + operation.Done;
+        if (Uring->FixedBuffers)
+            sqe->buf_index = static_cast<std::uint16_t>(operation.Buffer);
+    }
+    sqe->user_data = index;
+    Uring->Push();
+}
+
+void TAsyncWriter::Complete(const TCompletion &completion) {
+    TOperation &operation = Operations[completion.Operation];
+    const int fd = operation.Fd;
+    if (operation.Kind == EOperation::Write) {
+        if (completion.Result == -EINTR || completion.Result == -EAGAIN) {
+            Submit(completion.Operation);
+            return;
+        }
+        if (completion.Result > 0 && operation.Done + static_cast<std::size_t>(completion.Result) < operation.Size) {
+            operation.Done += static_cast<std::size_t>(completion.Result);
+            Submit(completion.Operation);
+            return;
+        }
+        if (completion.Result <= 0 && Error.empty())
+            Error = std::string("Cannot write: ") + (completion.Result < 0 ? strerror(static_cast<int>(-completion.Result)) : "no progress");
+        FreeBuffers.push_back(operation.Buffer);
+    } else if (completion.Result < 0 && Error.empty()) {
+        Error = std::string("Cannot sync: ") + strerror(static_cast<int>(-completion.Result));
+    }
+    FreeOperations.push_back(completion.Operation);
+    --Pending;
+    TFile &file = Files[fd];
+    --file.InFlight;
+    SubmitQueued(fd, file);
+}
+
+void TAsyncWriter::Reap(bool wait) {
+    Completions.clear();
+    if (Uring) {
+        // Completions are read from the shared ring, the system call is only needed to submit or to wait
+        if (wait || Uring->ToSubmit != 0) {
+            const int error = Uring->Enter(wait ? 1 : 0);
+            if (error != 0 && error != EAGAIN && error != EBUSY && Error.empty())
+                Error = std::string("io_uring_enter: ") + strerror(error);
+        }
+        Uring->Drain(Completions);
+    } else {
+        std::unique_lock<std::mutex> lock(Mutex);
+        if (wait)
+            DoneCondition.wait(lock, [this] { return !WorkerCompletions.empty(); });
+        Completions.swap(WorkerCompletions);
+    }
+    // Completing may submit more, which goes out with the next call
+    for (const auto &completion : Completions)
+        Complete(completion);
+}
+
+void TAsyncWriter::WorkerLoop(std::size_t worker) {
+    std::unique_lock<std::mutex> lock(Mutex);
+    for (;;) {
+        WorkCondition.wait(lock, [this, worker] { return Stopping || !Workers[worker].Queue.empty(); });
+        if (Workers[worker].Queue.empty())
+            return;
+        const std::size_t index = Workers[worker].Queue.front().first;
+        const TOperation operation = Workers[worker].Queue.front().second;
+        Workers[worker].Queue.pop_front();
+        lock.unlock();
+        long result = 0;
+        if (operation.Kind == EOperation::Sync) {
+            result = fdatasync(operation.Fd) == 0 ? 0 : -errno;
+        } else {
+            const char *data = Buffers + operation.Buffer * BufferSize + operation.Done;
+            const std::size_t size = operation.Size - operation.Done;
+            const ssize_t written = operation.Offset < 0
+                ? write(operation.Fd, data, size)
+                : pwrite(operation.Fd, data, size, static_cast<off_t>(operation.Offset + static_cast<std::int64_t>(operation.Done)));
+            result = written < 0 ? -errno : written;
+        }
+        lock.lock();
+        WorkerCompletions.push_back({index, result});
+        DoneCondition.notify_one();
+    }
+}
+
+bool TAsyncWriter::Check(std::string &error) {
+    if (Error.empty())
+        return true;
+    error = Error;
+    return false;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "output_page.h"
+
+
+// Writes output files in the background, so the fetch loop does not wait for the disk.
+// Bytes are copied into a fixed pool of buffers registered with io_uring, a buffer returns to the pool
+// once its write completes and Write waits only when every buffer is in flight. Regular files are written
+// at explicit offsets and synced with fdatasync every syncBytes, pipes and terminals get one write at a time.
+// Without io_uring (old kernels, seccomp) the same operations are run by worker threads.
+// Failures are sticky: once an operation fails every later call returns its error.
+class TAsyncWriter {
+    public:
+        TAsyncWriter(std::size_t bufferCount = 32, std::size_t bufferSize = 256 << 10, std::size_t syncBytes = 64 << 20);
+        ~TAsyncWriter();
+
+        bool IsUring() const;
+        bool Write(int fd, const char *data, std::size_t size, std::string &error);
+        bool Write(int fd, const TOutputPage &page, std::string &error);
+        // Syncs and closes the descriptor after its pending writes
+        bool Close(int fd, std::string &error);
+        // Handles finished operations without waiting
+        bool Pump(std::string &error);
+        // Syncs every regular file, waits for all operations and moves file positions past the written bytes.
+        // Descriptors are handed back: a later write takes the position of its file anew.
+        bool Flush(std::string &error);
+
+    private:
+        enum class EOperation {
+            Write,
+            Sync
+        };
+        struct TOperation {
+            EOperation Kind = EOperation::Write;
+            int Fd = -1;
+            std::size_t Buffer = 0;
+            std::size_t Size = 0;
+            // Bytes already written by short writes
+            std::size_t Done = 0;
+            // Negative for streams, which are written at their current position
+            std::int64_t Offset = -1;
+        };
+        struct TFile {
+            bool Regular = false;
+            std::int64_t Offset = 0;
+            std::size_t UnsyncedBytes = 0;
+            // Operations not submitted yet, in order
+            std::deque<std::size_t> Queue;
+            std::size_t InFlight = 0;
+            bool Closing = false;
+        };
+        struct TCompletion {
+            std::size_t Operation;
+            std::int64_t Result;
+        };
+        struct TUring;
+
+        std::size_t BufferSize;
+        std::size_t SyncBytes;
+        char *Buffers = nullptr;
+        std::vector<std::size_t> FreeBuffers;
+        // Buffer being filled by the current Write call
+        std::size_t OpenBuffer = 0;
+        std::size_t OpenBufferSize = 0;
+        bool HasOpenBuffer = false;
+        std::vector<TOperation> Operations;
+        std::vector<std::size_t> FreeOperations;
+        std::unordered_map<int, TFile> Files;
+        std::size_t Pending = 0;
+        std::vector<TCompletion> Completions;
+        std::string Error;
+
+        std::unique_ptr<TUring> Uring;
+
+        // Fallback: operations of a descriptor always go to the same thread
+        struct TWorker {
+            std::thread Thread;
+            // Copies, the table of operations may grow meanwhile
+            std::deque<std::pair<std::size_t, TOperation>> Queue;
+        };
+        std::mutex Mutex;
+        std::condition_variable WorkCondition;
+        std::condition_variable DoneCondition;
+        std::vector<TWorker> Workers;
+        std::vector<TCompletion> WorkerCompletions;
+        bool Stopping = false;
+
+        TAsyncWriter(const TAsyncWriter &) = delete;
+        TAsyncWriter &operator = (const TAsyncWriter &) = delete;
+        TAsyncWriter(TAsyncWriter &&) = delete;
+        TAsyncWriter &&operator = (TAsyncWriter &&) = delete;
+
+        TFile &GetFile(int fd);
+        void Append(int fd, const char *data, std::size_t size);
+        void SubmitBuffer(int fd);
+        std::size_t AddOperation(const TOperation &operation);
+        void SubmitQueued(int fd, TFile &file);
+        void Submit(std::size_t operation);
+        void Complete(const TCompletion &completion);
+        // Collects finished operations, waiting for at least one when asked to
+        void Reap(bool wait);
+        void WorkerLoop(std::size_t worker);
+        bool Check(std::string &error);
+};
@@ -0,0 +1,202 @@
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+#include <td/telegram/td_api.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "content.h"
+#include "json_writer.h"
+#include "output_page.h"
+#include "serializer.h"
+#include "text_index.h"
+#include "utf8.h"
+
+
+// Every heap allocation of the process is counted
+std::atomic<std::size_t> Allocations(0);
+
+void *operator new(std::size_t size) {
+    ++Allocations;
+    void *result = malloc(size != 0 ? size : 1);
+    if (!result)
+        throw std::bad_alloc();
+    return result;
+}
+
+void operator delete(void *pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept {
+    free(pointer);
+}
+
+
+namespace {
+    struct TCorpus {
+        const char *Name;
+        std::string Data;
+    };
+
+    std::string Repeat(const std::string &text, std::size_t size) {
+        std::string result;
+        result.reserve(size + text.size());
+        while (result.size() < size)
+            result += text;
+        return result;
+    }
+
+    namespace api = td::td_api;
+
+    api::object_ptr<api::formattedText> MakeText(const std::string &text) {
+        auto result = api::make_object<api::formattedText>();
+        result->text_ = text;
+        return result;
+    }
+
+    // Text messages with every fourth one being a captioned photo and every third one a reply
+    api::object_ptr<api::message> MakeMessage(std::int64_t id, const std::string &text) {
+        auto message = api::make_object<api::message>();
+        message->id_ = id << 20;
+        message->chat_id_ = -1001234567890LL;
+        message->date_ = static_cast<std::int32_t>(1700000000 + id * 60);
+        auto sender = api::make_object<api::messageSenderUser>();
+        sender->user_id_ = 1000 + id % 7;
+        message->sender_id_ = std::move(sender);
+        if (id % 3 == 0) {
+            auto reply = api::make_object<api::messageReplyToMessage>();
+            reply->chat_id_ = message->chat_id_;
+            reply->message_id_ = (id - 1) << 20;
+            message->reply_to_ = std::move(reply);
+        }
+        if (id % 4 == 0) {
+            auto file = api::make_object<api::file>();
+            file->id_ = static_cast<std::int32_t>(id);
+            file->size_ = 123456;
+            file->remote_ = api::make_object<api::remoteFile>();
+            file->remote_->id_ = "AgACAgIAAxkBAAI" + std::to_string(id);
+            file->remote_->unique_id_ = "AQADAgAT" + std::to_string(id);
+            auto size = api::make_object<api::photoSize>();
+            size->type_ = "x";
+            size->width_ = 800;
+            size->height_ = 600;
+            size->photo_ = std::move(file);
+            auto photo = api::make_object<api::messagePhoto>();
+            photo->photo_ = api::make_object<api::photo>();
+            photo->photo_->sizes_.push_back(std::move(size));
+            photo->caption_ = MakeText(text);
+            message->content_ = std::move(photo);
+        } else {
+            auto content = api::make_object<api::messageText>();
+            content->text_ = MakeText(text);
+            message->content_ = std::move(content);
+        }
+        return message;
+    }
+
+    // Serialises pages of 100 messages the way the fetcher does and reports allocations per message
+    void BenchmarkPages() {
+        const std::size_t pageSize = 100, pages = 200;
+        const std::string texts[] = {
+            "Short reply",
+            "The quick brown fox jumps over the lazy dog, \"quoted\" twice, and then some more words follow.",
+            "Съешь же ещё этих мягких французских булок, да выпей чаю \xF0\x9F\x98\x80",
+        };
+        std::vector<api::object_ptr<api::message>> messages;
+        for (std::size_t i = 0; i < pageSize; ++i)
+            messages.push_back(MakeMessage(static_cast<std::int64_t>(i + 1), texts[i % 3]));
+
+        TOutputPage page;
+        std::string output;
+        TArena arena;
+        std::size_t tokens = 0, files = 0, bytes = 0;
+        auto processPage = [&]() {
+            page.Clear();
+            for (const auto &message : messages) {
+                SerializeMessage(*message, EExportProfile::Full, false, page);
+                page.EndRecord();
+                if (const std::string *text = GetContentText(*message->content_))
+                    tokens += TokenizeText(*text, arena).size();
+                files += GetContentFiles(*message->content_, arena).size();
+            }
+            output.clear();
+            page.CopyTo(output);
+            bytes += output.size();
+            arena.Reset();
+        };
+        // The first page grows the buffers, later ones run in a steady state
+        processPage();
+        const std::size_t allocations = Allocations;
+        const auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < pages; ++i)
+            processPage();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const double count = static_cast<double>(pageSize * pages);
+        printf("\n%-10s %12s %12s %12s\n", "pages", "messages/s", "allocs/msg", "bytes/msg");
+        printf("%-10zu %12.0f %12.2f %12.0f\n", pages, count / seconds, (Allocations - allocations) / count, bytes / (count + pageSize));
+        if (tokens == 0 || files == 0)
+            printf("unexpected empty pages\n");
+    }
+
+    // Best of several rounds, in bytes per second
+    double Measure(const std::string &data, const std::function<void()> &run) {
+        double best = 0;
+        for (int round = 0; round < 5; ++round) {
+            const auto start = std::chrono::steady_clock::now();
+            run();
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (seconds > 0 && data.size() / seconds > best)
+                best = data.size() / seconds;
+        }
+        return best;
+    }
+}
+
+
+int main() {
+    const std::size_t size = 32 << 20;
+    std::vector<TCorpus> corpora = {
+        {"ascii", Repeat("The quick brown fox jumps over the lazy dog, \"quoted\" twice.\n", size)},
+        {"cyrillic", Repeat("Съешь же ещё этих мягких французских булок, да выпей чаю. ", size)},
+        {"mixed", Repeat("Meeting at 10:00 \xF0\x9F\x98\x80 Встреча в 10:00 \xE2\x9C\x85 \xE4\xBC\x9A\xE8\xAE\xAE ", size)},
+    };
+    // A single bad byte at the end, so that the scalar validator cannot stop early
+    TCorpus broken{"invalid", corpora[2].Data};
+    broken.Data.back() = '\xFF';
+    corpora.push_back(std::move(broken));
+
+    printf("%-10s %12s %12s %12s %12s\n", "corpus", "validate", "scalar", "repair", "write");
+    volatile bool sink = false;
+    for (const auto &corpus : corpora) {
+        const std::string &data = corpus.Data;
+        const double simd = Measure(data, [&]() {
+            sink = IsValidUtf8(data.data(), data.size());
+        });
+        const double scalar = Measure(data, [&]() {
+            sink = IsValidUtf8Scalar(data.data(), data.size());
+        });
+        std::string output;
+        output.reserve(data.size() * 2);
+        const double repair = Measure(data, [&]() {
+            output.clear();
+            RepairUtf8(data.data(), data.size(), output);
+        });
+        // Validation, repair when needed and escaping as done for every exported string
+        const double write = Measure(data, [&]() {
+            output.clear();
+            TJsonWriter writer(output, true);
+            writer.String(data);
+        });
+        printf("%-10s %9.2f GB/s %7.2f GB/s %7.2f GB/s %7.2f GB/s\n", corpus.Name, simd / 1e9, scalar / 1e9, repair / 1e9, write / 1e9);
+    }
+    BenchmarkPages();
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "chat_cache.h"
+
+
+namespace {
+    template <typename T>
+    void WriteValue(std::string &buffer, T value) {
+        buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    bool ReadValue(const std::string &buffer, std::size_t &offset, T &value) {
+        if (buffer.size() - offset < sizeof(value))
+            return false;
+        memcpy(&value, buffer.data() + offset, sizeof(value));
+        offset += sizeof(value);
+        return true;
+    }
+}
+
+
+const char *GetChatTypeName(EChatType type) {
+    switch (type) {
+        case EChatType::Unknown:
+            return "unknown";
+        case EChatType::Private:
+            return "private";
+        case EChatType::BasicGroup:
+            return "basic_group";
+        case EChatType::Supergroup:
+            return "supergroup";
+        case EChatType::Channel:
+            return "channel";
+        case EChatType::Secret:
+            return "secret";
+    }
+    return "unknown";
+}
+
+TChatCache::TChatCache(const std::string &path)
+    : Path(path)
+{
+    Rehash(64);
+}
+
+bool TChatCache::Load(std::string &error) {
+    std::ifstream fin(Path, std::ios::binary);
+    if (!fin)
+        return true;
+    std::string buffer((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+    std::size_t offset = 0;
+    std::uint32_t magic = 0;
+    std::uint32_t version = 0;
+    std::uint32_t count = 0;
+    if (!ReadValue(buffer, offset, magic) || !ReadValue(buffer, offset, version) || !ReadValue(buffer, offset, count)
+        || magic != Magic || version != Version) {
+        error = Path + " is not a chat cache";
+        return false;
+    }
+    // Every record takes its fixed fields at least, a damaged count must not allocate beyond the file
+    const std::size_t minRecordSize = sizeof(TChatRecord::ChatId) + sizeof(TChatRecord::LastMessageId)
+        + sizeof(TChatRecord::MemberCount) + sizeof(std::uint8_t) + sizeof(std::uint32_t);
+    if (count > (buffer.size() - offset) / minRecordSize) {
+        error = Path + " is truncated";
+        return false;
+    }
+    std::vector<TChatRecord> records(count);
+    for (auto &record : records) {
+        std::uint8_t type = 0;
+        std::uint32_t titleSize = 0;
+        if (!ReadValue(buffer, offset, record.ChatId) || !ReadValue(buffer, offset, record.LastMessageId)
+            || !ReadValue(buffer, offset, record.MemberCount) || !ReadValue(buffer, offset, type)
+            || !ReadValue(buffer, offset, titleSize) || buffer.size() - offset < titleSize) {
+            error = Path + " is truncated";
+            return false;
+        }
+        record.Type = type <= static_cast<std::uint8_t>(EChatType::Secret) ? static_cast<EChatType>(type) : EChatType::Unknown;
+        record.Title.assign(buffer, offset, titleSize);
+        offset += titleSize;
+    }
+    // Updates may have arrived before the load, they are newer than the file
+    std::vector<TChatRecord> updated;
+    updated.swap(Records);
+    Rehash(64);
+    for (auto &record : records)
+        Get(record.ChatId) = std::move(record);
+    for (auto &record : updated)
+        Get(record.ChatId) = std::move(record);
+    Dirty = !updated.empty();
+    return true;
+}
+
+bool TChatCache::Save(std::string &error) {
+    if (!Dirty)
+        return true;
+    std::string buffer;
+    buffer.reserve(16 + Records.size() * 64);
+    WriteValue(buffer, Magic);
+    WriteValue(buffer, Version);
+    WriteValue(buffer, static_cast<std::uint32_t>(Records.size()));
+    for (const auto &record : Records) {
+        WriteValue(buffer, record.ChatId);
+        WriteValue(buffer, record.LastMessageId);
+        WriteValue(buffer, record.MemberCount);
+        WriteValue(buffer, static_cast<std::uint8_t>(record.Type));
+        WriteValue(buffer, static_cast<std::uint32_t>(record.Title.size()));
+        buffer += record.Title;
+    }
+    // A crash leaves either the old or the new file
+    const std::string temporary = Path + ".tmp";
+    std::ofstream fout(temporary, std::ios::binary | std::ios::trunc);
+    if (!fout.write(buffer.data(), static_cast<std::streamsize>(buffer.size())) || !fout.flush()) {
+        error = "Cannot write " + temporary;
+        return false;
+    }
+    fout.close();
+    if (rename(temporary.c_str(), Path.c_str()) != 0) {
+        error = "Cannot rename " + temporary + ": " + strerror(errno);
+        return false;
+    }
+    Dirty = false;
+    return true;
+}
+
+TChatRecord &TChatCache::Get(long long chatId) {
+    Dirty = true;
+    std::size_t slot = FindSlot(chatId);
+    if (Slots[slot])
+        return Records[Slots[slot] - 1];
+    // The table stays at most half full, so probe sequences are short
+    if ((Records.size() + 1) * 2 > Slots.size()) {
+        Rehash(Slots.size() * 2);
+        slot = FindSlot(chatId);
+    }
+    Records.emplace_back();
+    Records.back().ChatId = chatId;
+    Slots[slot] = static_cast<std::uint32_t>(Records.size());
+    return Records.back();
+}
+
+const TChatRecord *TChatCache::Find(long long chatId) const {
+    const std::uint32_t index = Slots[FindSlot(chatId)];
+    return index ? &Records[index - 1] : nullptr;
+}
+
+std::size_t TChatCache::GetSize() const {
+    return Records.size();
+}
+
+const std::vector<TChatRecord> &TChatCache::GetRecords() const {
+    return Records;
+}
+
+std::size_t TChatCache::FindSlot(long long chatId) const {
+    // Fibonacci hashing spreads the sequential ids of users and groups over the table
+    const std::size_t mask = Slots.size() - 1;
+    std::size_t slot = static_cast<std::size_t>((static_cast<std::uint64_t>(chatId) * 11400714819323198485ULL) >> 32) & mask;
+    while (Slots[slot] && Records[Slots[slot] - 1].ChatId != chatId)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+void TChatCache::Rehash(std::size_t slots) {
+    Slots.assign(slots, 0);
+    for (std::size_t i = 0; i < Records.size(); ++i)
+        Slots[FindSlot(Records[i].ChatId)] = static_cast<std::uint32_t>(i + 1);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+enum class EChatType : std::uint8_t {
+    Unknown,
+    Private,
+    BasicGroup,
+    Supergroup,
+    Channel,
+    Secret
+};
+
+// What the fetcher knows about a chat without asking TDLib
+struct TChatRecord {
+    long long ChatId = 0;
+    long long LastMessageId = 0;
+    std::int32_t MemberCount = 0;
+    EChatType Type = EChatType::Unknown;
+    std::string Title;
+};
+
+// Metadata of every chat of an account, filled from updates and kept in a binary file between runs.
+// Records are stored contiguously and found through an open addressing table of their indexes, so
+// tens of thousands of chats cost a few allocations and a lookup is one or two probes.
+class TChatCache {
+    public:
+        explicit TChatCache(const std::string &path);
+
+        // A missing file is an empty cache, a damaged one is reported and ignored
+        bool Load(std::string &error);
+        // Replaces the file atomically, does nothing unless something changed since the last save
+        bool Save(std::string &error);
+        // Record to update, an empty one for an unknown chat, valid until the next insert
+        TChatRecord &Get(long long chatId);
+        const TChatRecord *Find(long long chatId) const;
+        std::size_t GetSize() const;
+        const std::vector<TChatRecord> &GetRecords() const;
+
+    private:
+        static constexpr std::uint32_t Magic = 0x43485443;
+        static constexpr std::uint32_t Version = 1;
+
+        std::string Path;
+        std::vector<TChatRecord> Records;
+        // Index of the record plus one, zero for a free slot, the size is a power of two
+        std::vector<std::uint32_t> Slots;
+        bool Dirty = false;
+
+        TChatCache(const TChatCache &) = delete;
+        TChatCache &operator = (const TChatCache &) = delete;
+        TChatCache(TChatCache &&) = delete;
+        TChatCache &&operator = (TChatCache &&) = delete;
+
+        std::size_t FindSlot(long long chatId) const;
+        void Rehash(std::size_t slots);
+};
+
+const char *GetChatTypeName(EChatType type);
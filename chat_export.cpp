@@ -0,0 +1,772 @@
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+#include <td/telegram/td_api.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "chat_export.h"
+#include "content.h"
+#include "filter.h"
+#include "helpers.h"
+#include "media_store.h"
+#include "reflection.h"
+#include "serializer.h"
+
+
+constexpr std::size_t TChatExport::GroupedBufferSize;
+
+namespace {
+    TStoredMessage MakeStoredMessage(td::td_api::message &message) {
+        TStoredMessage row;
+        row.ChatId = message.chat_id_;
+        row.MessageId = message.id_;
+        row.Date = message.date_;
+        row.EditDate = message.edit_date_;
+        row.SenderId = GetSenderId(message);
+        row.ThreadId = message.message_thread_id_;
+        return row;
+    }
+}
+
+
+TChatExport::TChatExport(TQuerySender querySender, const TOptions &options, std::size_t account, const std::atomic<bool> *exit)
+    : QuerySender(std::move(querySender))
+    , Options(options)
+    , Account(account)
+    , Exit(exit)
+{
+}
+
+TChatExport::~TChatExport() {
+    // Pending writes go out before the descriptors are closed
+    AsyncWriter.reset();
+    for (const auto &task : HistoryTasks) {
+        if (task->Fd >= 0)
+            close(task->Fd);
+        if (task->SpillFd >= 0)
+            close(task->SpillFd);
+    }
+}
+
+bool TChatExport::Start(std::string &error) {
+    Running = true;
+    const TOptions &options = Options;
+    const long long chatId = options.ChatId;
+    // Files are not referenced by the output unless the profile keeps media
+    if (options.DownloadMedia && (options.Profile == EExportProfile::Media || options.Profile == EExportProfile::Full)) {
+        DownloadManager = std::make_unique<TDownloadManager>(
+            [this](td::td_api::object_ptr<td::td_api::Function> f, std::function<void(Object)> handler) {
+                SendQuery(std::move(f), std::move(handler));
+            },
+            options.MaxActiveDownloads
+        );
+        MediaStore = std::make_unique<TMediaStore>(options.MediaDirectory);
+    }
+    if (!options.ReplyIndexDirectory.empty())
+        ReplyIndex = std::make_unique<TReplyIndexWriter>(options.ReplyIndexDirectory);
+    if (!options.TextIndexDirectory.empty())
+        TextIndex = std::make_unique<TTextIndexWriter>(options.TextIndexDirectory);
+    if (!options.SegmentDirectory.empty()) {
+        Segments = std::make_unique<TSegmentWriter>(
+            options.SegmentDirectory + "/chat_" + std::to_string(chatId), options.SegmentSize, options.SegmentMessages
+        );
+    }
+    if (!options.PartitionDirectory.empty()) {
+        Partitions = std::make_unique<TPartitionedOutput>(
+            options.PartitionDirectory, "chat_" + std::to_string(chatId) + ".jsonl", options.PartitionKey, options.PartitionBuckets, options.MaxOpenPartitions
+        );
+    }
+    if (!options.SqlitePath.empty()) {
+        Sqlite = std::make_unique<TSqliteStore>(options.SqlitePath);
+        if (!Sqlite->Open(error)) {
+            error = "Failed to open " + options.SqlitePath + ": " + error;
+            return false;
+        }
+    }
+    if (options.AsyncOutput) {
+        AsyncWriter = std::make_unique<TAsyncWriter>();
+        std::cerr << "Output is written " << (AsyncWriter->IsUring() ? "through io_uring" : "by writer threads") << std::endl;
+    }
+    if (!options.OutputPath.empty()) {
+        Durable = std::make_unique<TDurableOutput>(options.OutputPath, 16 << 20, options.CommitInterval);
+        if (!Durable->Open(error)) {
+            error = "Failed to open " + options.OutputPath + ": " + error;
+            return false;
+        }
+    }
+    if (!options.RingPath.empty()) {
+        Ring = std::make_unique<TRingWriter>();
+        if (!Ring->Open(options.RingPath, options.RingSize, error)) {
+            error = "Failed to create ring " + options.RingPath + ": " + error;
+            return false;
+        }
+        // Ctrl+C interrupts a producer which waits for the consumer
+        Ring->SetStopFlag(Exit);
+    }
+    std::cerr << "Starting fetching history for the chat_id " << chatId << " with account " << Account << std::endl;
+    // Updates of supergroups and channels come only for open chats
+    if (options.Follow)
+        SendQuery(td::td_api::make_object<td::td_api::openChat>(chatId), {});
+    StartHistory();
+    return true;
+}
+
+void TChatExport::Pump() {
+    if (!Running)
+        return;
+    FetchHistory();
+    if (DownloadManager)
+        DownloadManager->Pump();
+    PumpOutput();
+}
+
+void TChatExport::OnUpdate(td::td_api::Object &update) {
+    td::td_api::downcast_call(
+        update, overloaded(
+            [this](td::td_api::updateFile &update) {
+                if (DownloadManager && update.file_)
+                    DownloadManager->OnFileUpdate(*update.file_);
+            },
+            [this](td::td_api::updateNewMessage &update) {
+                if (Options.Follow && update.message_ && update.message_->chat_id_ == Options.ChatId)
+                    WriteChange(EMessageChange::Insert, *update.message_);
+            },
+            [this](td::td_api::updateMessageContent &update) {
+                if (Options.Follow && update.chat_id_ == Options.ChatId)
+                    RequestEdit(update.message_id_);
+            },
+            [this](td::td_api::updateMessageEdited &update) {
+                if (Options.Follow && update.chat_id_ == Options.ChatId)
+                    RequestEdit(update.message_id_);
+            },
+            [this](td::td_api::updateDeleteMessages &update) {
+                // Messages only evicted from the local cache still exist
+                if (Options.Follow && update.chat_id_ == Options.ChatId && update.is_permanent_ && !update.from_cache_)
+                    WriteDeletion(update.message_ids_);
+            },
+            [](auto &) {
+            }
+        )
+    );
+}
+
+void TChatExport::Stop() {
+    if (!Running)
+        return;
+    Running = false;
+    for (auto &task : HistoryTasks)
+        task->Finished = true;
+}
+
+void TChatExport::Fail(const std::string &error) {
+    std::cerr << error << std::endl;
+    if (Error.empty())
+        Error = error;
+    Stop();
+}
+
+void TChatExport::Finish() {
+    Running = false;
+    // Files of tasks cut short are closed after their pending writes
+    std::string error;
+    for (auto &task : HistoryTasks) {
+        if (task->SpillFd >= 0) {
+            close(task->SpillFd);
+            task->SpillFd = -1;
+        }
+        if (task->Fd < 0)
+            continue;
+        if (AsyncWriter)
+            AsyncWriter->Close(task->Fd, error);
+        else
+            close(task->Fd);
+        task->Fd = -1;
+    }
+    FinishOutputs();
+    if (Options.Follow)
+        SendQuery(td::td_api::make_object<td::td_api::closeChat>(Options.ChatId), {});
+    AsyncWriter.reset();
+    Ring.reset();
+    DownloadManager.reset();
+    MediaStore.reset();
+    HistoryTasks.clear();
+    PendingEdits.clear();
+}
+
+bool TChatExport::IsRunning() const {
+    return Running;
+}
+
+bool TChatExport::IsComplete() const {
+    return Running && HistoryFetched && !Options.Follow && Queries == 0 && (!DownloadManager || DownloadManager->IsIdle());
+}
+
+bool TChatExport::HasPendingQueries() const {
+    return Queries != 0;
+}
+
+const TOptions &TChatExport::GetOptions() const {
+    return Options;
+}
+
+const std::string &TChatExport::GetError() const {
+    return Error;
+}
+
+std::size_t TChatExport::GetMessageCount() const {
+    return Messages;
+}
+
+void TChatExport::SendQuery(td::td_api::object_ptr<td::td_api::Function> f, std::function<void(Object)> handler) {
+    if (handler) {
+        ++Queries;
+        handler = [this, handler = std::move(handler)](Object object) {
+            --Queries;
+            handler(std::move(object));
+        };
+    }
+    QuerySender(std::move(f), std::move(handler));
+}
+
+void TChatExport::StartHistory() {
+    if (Options.Threads) {
+        ListForumTopics(0, 0, 0);
+        return;
+    }
+    if (Options.Shards <= 1) {
+        AddHistoryTask(Options.Filter, 0, "shard_000");
+        HistoryPlanned = true;
+        return;
+    }
+    if (Options.Filter.MinDate != 0) {
+        PlanShards(Options.Filter.MinDate);
+        return;
+    }
+    // The oldest messages of the chat are the newest ones after the first server message id
+    const long long firstMessageId = 1LL << 20;
+    SendQuery(td::td_api::make_object<td::td_api::getChatHistory>(Options.ChatId, firstMessageId, -99, 100, false), [this](Object object) {
+        std::int32_t minDate = 0;
+        td::td_api::downcast_call(
+            *object, overloaded(
+                [&minDate](td::td_api::messages &messages) {
+                    for (const auto &message : messages.messages_)
+                        if (message && (minDate == 0 || message->date_ < minDate))
+                            minDate = message->date_;
+                },
+                [](auto &) {
+                }
+            )
+        );
+        PlanShards(minDate);
+    });
+}
+
+void TChatExport::ListForumTopics(std::int32_t offsetDate, long long offsetMessageId, long long offsetThreadId) {
+    auto request = td::td_api::make_object<td::td_api::getForumTopics>();
+    request->chat_id_ = Options.ChatId;
+    request->offset_date_ = offsetDate;
+    request->offset_message_id_ = offsetMessageId;
+    request->offset_message_thread_id_ = offsetThreadId;
+    request->limit_ = 100;
+    SendQuery(std::move(request), [this](Object object) {
+        bool hasMore = false;
+        td::td_api::downcast_call(
+            *object, overloaded(
+                [this, &hasMore](td::td_api::forumTopics &topics) {
+                    for (const auto &topic : topics.topics_) {
+                        if (!topic || !topic->info_)
+                            continue;
+                        const long long threadId = topic->info_->message_thread_id_;
+                        std::cerr << "Topic " << threadId << ": " << topic->info_->name_ << std::endl;
+                        AddHistoryTask(Options.Filter, threadId, "thread_" + std::to_string(threadId));
+                    }
+                    hasMore = !topics.topics_.empty() && (topics.next_offset_date_ != 0 || topics.next_offset_message_id_ != 0 || topics.next_offset_message_thread_id_ != 0);
+                    if (hasMore)
+                        ListForumTopics(topics.next_offset_date_, topics.next_offset_message_id_, topics.next_offset_message_thread_id_);
+                },
+                [](td::td_api::error &error) {
+                    std::cerr << "Failed to list forum topics: " << error.message_ << std::endl;
+                },
+                [](auto &) {
+                }
+            )
+        );
+        if (!hasMore) {
+            std::cerr << "Fetching " << HistoryTasks.size() << " threads" << std::endl;
+            HistoryPlanned = true;
+        }
+    });
+}
+
+void TChatExport::PlanShards(std::int32_t minDate) {
+    HistoryPlanned = true;
+    const std::int64_t maxDate = Options.Filter.MaxDate != 0 ? Options.Filter.MaxDate : time(nullptr) + 1;
+    if (minDate == 0 || minDate >= maxDate) {
+        AddHistoryTask(Options.Filter, 0, "shard_000");
+        return;
+    }
+    const std::int64_t shards = Options.Shards;
+    for (std::int64_t i = 0; i < shards; ++i) {
+        TMessageFilter filter = Options.Filter;
+        filter.MinDate = static_cast<std::int32_t>(minDate + (maxDate - minDate) * i / shards);
+        filter.MaxDate = static_cast<std::int32_t>(minDate + (maxDate - minDate) * (i + 1) / shards);
+        std::cerr << "Shard " << i << ": dates [" << filter.MinDate << ", " << filter.MaxDate << ")" << std::endl;
+        char name[32];
+        snprintf(name, sizeof(name), "shard_%03lld", static_cast<long long>(i));
+        AddHistoryTask(filter, 0, name);
+    }
+}
+
+void TChatExport::AddHistoryTask(const TMessageFilter &filter, long long threadId, const std::string &name) {
+    auto task = std::make_unique<THistoryTask>();
+    task->Name = name;
+    task->Pager = std::make_unique<THistoryPager>(Options.ChatId, filter, threadId);
+    task->Progress.MinDate = filter.MinDate;
+    task->Progress.MaxDate = filter.MaxDate;
+    task->Progress.ThreadId = threadId;
+    TTaskProgress progress;
+    if (Durable && Durable->GetProgress(name, progress)) {
+        if (progress.MinDate != filter.MinDate || progress.MaxDate != filter.MaxDate || progress.ThreadId != threadId) {
+            std::cerr << "Task " << name << " has other bounds than in the checkpoint, fetching it from the start" << std::endl;
+        } else if (progress.Finished) {
+            std::cerr << "Task " << name << " is already written" << std::endl;
+            task->Finished = true;
+        } else if (progress.LastMessageId != 0) {
+            std::cerr << "Task " << name << " resumes after message " << progress.LastMessageId << std::endl;
+            task->Pager->ResumeAfter(progress.LastMessageId);
+            task->Progress.LastMessageId = progress.LastMessageId;
+        }
+    }
+    // Shards are never resumed, --output with its checkpoint cannot be combined with them
+    if (!Options.ShardDirectory.empty()) {
+        MakeDirectories(Options.ShardDirectory);
+        const std::string path = Options.ShardDirectory + "/" + name + ".jsonl";
+        task->Fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (task->Fd < 0) {
+            task->Finished = true;
+            Fail("Failed to create " + path + ": " + strerror(errno));
+        }
+    }
+    // Threads are paged concurrently but written to stdout one after another
+    task->Grouped = threadId != 0;
+    HistoryTasks.push_back(std::move(task));
+}
+
+bool TChatExport::FetchHistory() {
+    if (!HistoryPlanned || !Running)
+        return false;
+    std::size_t active = 0;
+    for (const auto &task : HistoryTasks)
+        if (task->Started && !task->Finished)
+            ++active;
+    bool done = true;
+    for (auto &task : HistoryTasks) {
+        if (task->Finished)
+            continue;
+        done = false;
+        if (task->Fetching)
+            continue;
+        if (!task->Started) {
+            if (active >= Options.MaxParallelTasks)
+                continue;
+            task->Started = true;
+            ++active;
+        }
+        auto request = task->Pager->NextRequest();
+        if (!request) {
+            FinishHistoryTask(*task);
+            --active;
+            continue;
+        }
+        task->Fetching = true;
+        THistoryTask *taskPtr = task.get();
+        SendQuery(std::move(request), [this, taskPtr](Object object) {
+            WriteMessages(*taskPtr, taskPtr->Pager->OnResponse(std::move(object)));
+            taskPtr->Fetching = false;
+        });
+    }
+    if (done && !HistoryFetched) {
+        HistoryFetched = true;
+        std::size_t requests = 0;
+        for (const auto &task : HistoryTasks)
+            requests += task->Pager->GetRequestCount();
+        std::cerr << "History of chat " << Options.ChatId << " fetched with " << requests << " requests" << std::endl;
+        if (InvalidUtf8Messages != 0)
+            std::cerr << InvalidUtf8Messages << " messages contained invalid UTF-8" << (Options.RepairUtf8 ? ", replaced with U+FFFD" : "") << std::endl;
+        for (const auto &item : TakeUndescribedCounts())
+            std::cerr << item.second << " values of " << item.first << " were written without their fields" << std::endl;
+        // Following keeps the sinks open for the change log
+        if (Options.Follow) {
+            FinishIndexes();
+            std::cerr << "Following changes of chat " << Options.ChatId << std::endl;
+        } else {
+            FinishOutputs();
+        }
+    }
+    return done;
+}
+
+void TChatExport::FinishHistoryTask(THistoryTask &task) {
+    task.Finished = true;
+    std::string error;
+    bool written = true;
+    if (task.SpillFd >= 0) {
+        written = SpillGroupedOutput(task, error) && ReplayGroupedOutput(task, error);
+        close(task.SpillFd);
+        task.SpillFd = -1;
+    } else if (!task.Buffer.empty()) {
+        written = WriteGroupedOutput(task.Buffer, error);
+    }
+    std::string().swap(task.Buffer);
+    if (task.Fd >= 0) {
+        // The writer closes the file once its writes are synced
+        if (AsyncWriter)
+            written = AsyncWriter->Close(task.Fd, error) && written;
+        else
+            close(task.Fd);
+        task.Fd = -1;
+    }
+    if (Durable) {
+        task.Progress.Finished = true;
+        Durable->SetProgress(task.Name, task.Progress);
+        written = Durable->Pump(error) && written;
+    }
+    if (!written) {
+        Fail("Failed to write messages: " + error);
+    }
+}
+
+void TChatExport::WriteMessages(THistoryTask &task, THistoryPager::TMessages messages) {
+    // The page is written at once from a reused buffer, temporaries of its messages live in the page arena.
+    // Long strings are not copied into the buffer but gathered from the messages, which live until the write.
+    Page.Clear();
+    SegmentEntries.clear();
+    PartitionFields.clear();
+    StoredMessages.clear();
+    for (auto &message : messages) {
+        if (!SerializeMessage(*message, Options.Profile, Options.RepairUtf8, Page))
+            ++InvalidUtf8Messages;
+        Page.EndRecord();
+        if (Segments) {
+            SegmentEntries.emplace_back();
+            SegmentEntries.back().MessageId = message->id_;
+            SegmentEntries.back().Date = message->date_;
+        }
+        if (Partitions) {
+            PartitionFields.emplace_back();
+            PartitionFields.back().Date = message->date_;
+            PartitionFields.back().SenderId = GetSenderId(*message);
+            PartitionFields.back().ThreadId = message->message_thread_id_;
+        }
+        if (Sqlite)
+            StoredMessages.push_back(MakeStoredMessage(*message));
+        if (DownloadManager && message->content_)
+            ScheduleDownloads(*message->content_);
+        if (ReplyIndex)
+            AddReplyEdge(*message);
+        if (TextIndex && message->content_) {
+            const std::string *text = GetContentText(*message->content_);
+            if (text)
+                TextIndex->Add({message->chat_id_, message->id_}, *text, PageArena);
+        }
+    }
+    Messages += messages.size();
+    std::string error;
+    bool written = true;
+    if (task.Fd >= 0) {
+        written = AsyncWriter ? AsyncWriter->Write(task.Fd, Page, error) : Page.WriteTo(task.Fd, error);
+    } else if (Segments) {
+        // Segments are searched through their indices, so threads need not be grouped there
+        written = Segments->Write(Page, SegmentEntries, error);
+    } else if (Partitions) {
+        written = Partitions->Write(Page, PartitionFields, error);
+    } else if (Sqlite) {
+        // A page is upserted within one transaction, which spans further pages until it holds enough rows
+        written = Sqlite->Write(Page, StoredMessages, error);
+    } else if (Durable) {
+        // The progress is committed together with the page, threads are resumed separately and not grouped
+        written = Durable->Write(Page, error);
+        if (written) {
+            task.Progress.LastMessageId = task.Pager->GetLastMessageId();
+            Durable->SetProgress(task.Name, task.Progress);
+            written = Durable->Pump(error);
+        }
+    } else if (task.Grouped) {
+        Page.CopyTo(task.Buffer);
+        // Long topics wait in a temporary file rather than in memory
+        if (task.Buffer.size() >= GroupedBufferSize)
+            written = SpillGroupedOutput(task, error);
+    } else if (Ring) {
+        // Blocks while the ring is full, so no further pages are requested until the consumer catches up
+        written = Ring->Write(Page, error);
+    } else {
+        std::cout.flush();
+        written = AsyncWriter ? AsyncWriter->Write(STDOUT_FILENO, Page, error) : Page.WriteTo(STDOUT_FILENO, error);
+    }
+    if (!written) {
+        Fail("Failed to write messages: " + error);
+    }
+    PageArena.Reset();
+}
+
+bool TChatExport::SpillGroupedOutput(THistoryTask &task, std::string &error) {
+    if (task.SpillFd < 0) {
+        const char *directory = getenv("TMPDIR");
+        std::string path = std::string(directory && *directory ? directory : "/tmp") + "/fetcher_topic_XXXXXX";
+        task.SpillFd = mkstemp(&path[0]);
+        if (task.SpillFd < 0) {
+            error = "Cannot create a temporary file in " + path + ": " + strerror(errno);
+            return false;
+        }
+        unlink(path.c_str());
+    }
+    std::size_t offset = 0;
+    while (offset < task.Buffer.size()) {
+        const ssize_t size = write(task.SpillFd, task.Buffer.data() + offset, task.Buffer.size() - offset);
+        if (size < 0 && errno == EINTR)
+            continue;
+        if (size < 0) {
+            error = std::string("Cannot write a temporary file: ") + strerror(errno);
+            return false;
+        }
+        offset += static_cast<std::size_t>(size);
+    }
+    task.Buffer.clear();
+    return true;
+}
+
+bool TChatExport::WriteGroupedOutput(const std::string &lines, std::string &error) {
+    if (Ring)
+        WriteRingRecords(lines);
+    else if (AsyncWriter)
+        return AsyncWriter->Write(STDOUT_FILENO, lines.data(), lines.size(), error);
+    else
+        std::cout << lines << std::flush;
+    return true;
+}
+
+bool TChatExport::ReplayGroupedOutput(THistoryTask &task, std::string &error) {
+    if (lseek(task.SpillFd, 0, SEEK_SET) != 0) {
+        error = std::string("Cannot rewind a temporary file: ") + strerror(errno);
+        return false;
+    }
+    // Chunks end at record boundaries, records of the ring must not be split
+    std::string chunk;
+    char buffer[1 << 16];
+    while (true) {
+        const ssize_t size = read(task.SpillFd, buffer, sizeof(buffer));
+        if (size < 0 && errno == EINTR)
+            continue;
+        if (size < 0) {
+            error = std::string("Cannot read a temporary file: ") + strerror(errno);
+            return false;
+        }
+        if (size == 0)
+            break;
+        chunk.append(buffer, static_cast<std::size_t>(size));
+        if (chunk.size() < GroupedBufferSize)
+            continue;
+        const std::size_t end = chunk.rfind('\n') + 1;
+        if (end == 0)
+            continue;
+        if (!WriteGroupedOutput(chunk.substr(0, end), error))
+            return false;
+        chunk.erase(0, end);
+    }
+    return chunk.empty() || WriteGroupedOutput(chunk, error);
+}
+
+void TChatExport::RequestEdit(long long messageId) {
+    // Content and edit date of one edit come in separate updates, a message changed while fetched is fetched again
+    auto it = PendingEdits.find(messageId);
+    if (it != PendingEdits.end()) {
+        it->second = true;
+        return;
+    }
+    PendingEdits[messageId] = false;
+    SendQuery(td::td_api::make_object<td::td_api::getMessage>(Options.ChatId, messageId), [this, messageId](Object object) {
+        const bool changed = PendingEdits[messageId];
+        PendingEdits.erase(messageId);
+        if (object->get_id() == td::td_api::message::ID)
+            WriteChange(EMessageChange::Edit, static_cast<td::td_api::message &>(*object));
+        else
+            std::cerr << "Failed to get edited message " << messageId << std::endl;
+        if (changed)
+            RequestEdit(messageId);
+    });
+}
+
+void TChatExport::WriteChange(EMessageChange change, td::td_api::message &message) {
+    // Live messages are newer than any date bound
+    TMessageFilter filter = Options.Filter;
+    filter.MinDate = filter.MaxDate = 0;
+    if (!MatchesFilter(filter, message))
+        return;
+    Page.Clear();
+    StoredMessages.clear();
+    bool valid = true;
+    if (Sqlite) {
+        // The table holds the current state, so changes are applied instead of logged
+        valid = SerializeMessage(message, Options.Profile, Options.RepairUtf8, Page);
+        StoredMessages.push_back(MakeStoredMessage(message));
+    } else {
+        valid = SerializeMessageChange(change, message, Options.Profile, Options.RepairUtf8, Page);
+    }
+    Page.EndRecord();
+    if (!valid)
+        ++InvalidUtf8Messages;
+    ++Messages;
+    if (DownloadManager && message.content_)
+        ScheduleDownloads(*message.content_);
+    WriteChangePage();
+    PageArena.Reset();
+}
+
+void TChatExport::WriteDeletion(const std::vector<std::int64_t> &messageIds) {
+    std::string error;
+    if (Sqlite) {
+        if (!Sqlite->Delete(Options.ChatId, messageIds, error) || !Sqlite->Finish(error)) {
+            Fail("Failed to write messages: " + error);
+        }
+        return;
+    }
+    Page.Clear();
+    SerializeDeletion(Options.ChatId, messageIds, Page);
+    Page.EndRecord();
+    WriteChangePage();
+}
+
+void TChatExport::WriteChangePage() {
+    std::string error;
+    bool written = true;
+    if (Sqlite) {
+        // Committed at once, so that the table is current
+        written = Sqlite->Write(Page, StoredMessages, error) && Sqlite->Finish(error);
+    } else if (Durable) {
+        written = Durable->Write(Page, error) && Durable->Pump(error);
+    } else if (Ring) {
+        written = Ring->Write(Page, error);
+    } else {
+        std::cout.flush();
+        written = AsyncWriter ? AsyncWriter->Write(STDOUT_FILENO, Page, error) : Page.WriteTo(STDOUT_FILENO, error);
+    }
+    if (!written) {
+        Fail("Failed to write messages: " + error);
+    }
+}
+
+void TChatExport::PumpOutput() {
+    std::string error;
+    if ((AsyncWriter && !AsyncWriter->Pump(error)) || (Durable && !Durable->Pump(error))) {
+        Fail("Failed to write messages: " + error);
+    }
+}
+
+void TChatExport::WriteRingRecords(const std::string &lines) {
+    std::string error;
+    std::size_t begin = 0;
+    while (begin < lines.size()) {
+        std::size_t end = lines.find('\n', begin);
+        if (end == std::string::npos)
+            end = lines.size();
+        if (!Ring->Write(lines.data() + begin, end - begin, error)) {
+            Fail("Failed to write messages: " + error);
+            return;
+        }
+        begin = end + 1;
+    }
+}
+
+void TChatExport::ScheduleDownloads(td::td_api::MessageContent &content) {
+    for (const auto &file : GetContentFiles(content, PageArena))
+        ScheduleDownload(*file.File, file.Priority);
+}
+
+void TChatExport::ScheduleDownload(const td::td_api::file &file, std::int32_t priority) {
+    std::string uniqueId = file.remote_ ? file.remote_->unique_id_ : std::string();
+    if (!uniqueId.empty() && MediaStore->Contains(uniqueId))
+        return;
+    DownloadManager->Enqueue(file.id_, uniqueId, priority, [this](const TDownloadManager::TResult &result) {
+        std::string error = result.Error;
+        if (result.Ok && !result.UniqueId.empty() && MediaStore->Add(result.UniqueId, result.Path, error))
+            return;
+        std::cerr << "Failed to store file " << result.FileId << ' ' << result.UniqueId << ": " << error << std::endl;
+    });
+}
+
+void TChatExport::AddReplyEdge(const td::td_api::message &message) {
+    if (!message.reply_to_ || message.reply_to_->get_id() != td::td_api::messageReplyToMessage::ID)
+        return;
+    const auto &reply = static_cast<const td::td_api::messageReplyToMessage &>(*message.reply_to_);
+    if (reply.message_id_ == 0)
+        return;
+    // Replies within the same chat leave the chat id empty
+    const long long replyChatId = reply.chat_id_ != 0 ? reply.chat_id_ : message.chat_id_;
+    ReplyIndex->Add({replyChatId, reply.message_id_}, {message.chat_id_, message.id_});
+}
+
+void TChatExport::FinishIndexes() {
+    std::string error;
+    if (ReplyIndex) {
+        if (ReplyIndex->Finish(error))
+            std::cerr << "Reply index written to " << Options.ReplyIndexDirectory << std::endl;
+        else
+            std::cerr << "Failed to write reply index: " << error << std::endl;
+        ReplyIndex.reset();
+    }
+    if (TextIndex) {
+        if (TextIndex->Finish(error))
+            std::cerr << "Text index written to " << Options.TextIndexDirectory << std::endl;
+        else
+            std::cerr << "Failed to write text index: " << error << std::endl;
+        TextIndex.reset();
+    }
+}
+
+void TChatExport::FinishOutputs() {
+    FinishIndexes();
+    std::string error;
+    if (Segments) {
+        if (Segments->Finish(error))
+            std::cerr << "Segments written to " << Options.SegmentDirectory << std::endl;
+        else
+            std::cerr << "Failed to write segments: " << error << std::endl;
+        Segments.reset();
+    }
+    if (Partitions) {
+        if (Partitions->Finish(error))
+            std::cerr << Partitions->GetPartitionCount() << " partitions written to " << Options.PartitionDirectory << std::endl;
+        else
+            std::cerr << "Failed to write partitions: " << error << std::endl;
+        Partitions.reset();
+    }
+    if (Sqlite) {
+        if (Sqlite->Finish(error))
+            std::cerr << Sqlite->GetRowCount() << " messages upserted into " << Options.SqlitePath << std::endl;
+        else
+            std::cerr << "Failed to write " << Options.SqlitePath << ": " << error << std::endl;
+        Sqlite.reset();
+    }
+    if (AsyncWriter && !AsyncWriter->Flush(error))
+        std::cerr << "Failed to write messages: " << error << std::endl;
+    if (Durable) {
+        if (Durable->Commit(error))
+            std::cerr << "Output committed to " << Options.OutputPath << std::endl;
+        else
+            std::cerr << "Failed to commit " << Options.OutputPath << ": " << error << std::endl;
+        Durable.reset();
+    }
+    // The consumer reads the rest of the ring and stops
+    if (Ring)
+        Ring->Close();
+}
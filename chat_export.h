@@ -0,0 +1,147 @@
+#pragma once
+
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "arena.h"
+#include "async_writer.h"
+#include "downloader.h"
+#include "durable_output.h"
+#include "history.h"
+#include "media_store.h"
+#include "options.h"
+#include "output_page.h"
+#include "partitioned_output.h"
+#include "reply_index.h"
+#include "ring_buffer.h"
+#include "segment_store.h"
+#include "serializer.h"
+#include "sqlite_store.h"
+#include "text_index.h"
+
+
+// One export job: pages the history of a chat on one account and writes it into the outputs of its options.
+// Every job has its own outputs, page buffers and requests, so jobs of different accounts run side by side.
+// Requests are counted, the job must outlive the answers to them.
+class TChatExport {
+    public:
+        using Object = td::td_api::object_ptr<td::td_api::Object>;
+        using TQuerySender = std::function<void(td::td_api::object_ptr<td::td_api::Function>, std::function<void(Object)>)>;
+
+        // The exit flag interrupts a write into a full ring
+        TChatExport(TQuerySender querySender, const TOptions &options, std::size_t account, const std::atomic<bool> *exit);
+        ~TChatExport();
+
+        // Creates the outputs and starts the history, fills error on failure
+        bool Start(std::string &error);
+        // Sends next pages, schedules downloads and handles finished background writes
+        void Pump();
+        // Updates of the account: files being downloaded and changes of a followed chat
+        void OnUpdate(td::td_api::Object &update);
+        // Stops requesting history, the job is over once all of its requests are answered
+        void Stop();
+        // Stops the job after an output error
+        void Fail(const std::string &error);
+        // Finishes the outputs, the job does nothing afterwards
+        void Finish();
+
+        bool IsRunning() const;
+        // The history is written and nothing is waited for
+        bool IsComplete() const;
+        bool HasPendingQueries() const;
+        const TOptions &GetOptions() const;
+        const std::string &GetError() const;
+        std::size_t GetMessageCount() const;
+
+    private:
+        struct THistoryTask {
+            std::string Name;
+            std::unique_ptr<THistoryPager> Pager;
+            // Recorded in the checkpoint of the durable output
+            TTaskProgress Progress;
+            // Output of the task when tasks are written separately, stdout otherwise
+            int Fd = -1;
+            // Output kept until the task finishes, so that stdout is grouped by task
+            bool Grouped = false;
+            std::string Buffer;
+            // Unlinked temporary file which takes the buffer once it grows beyond GroupedBufferSize
+            int SpillFd = -1;
+            bool Started = false;
+            bool Fetching = false;
+            bool Finished = false;
+        };
+        static constexpr std::size_t GroupedBufferSize = 16 << 20;
+
+        TQuerySender QuerySender;
+        TOptions Options;
+        std::size_t Account;
+        const std::atomic<bool> *Exit;
+        bool Running = false;
+        std::string Error;
+        std::size_t Messages = 0;
+        // Requests which are not answered yet
+        std::size_t Queries = 0;
+        std::vector<std::unique_ptr<THistoryTask>> HistoryTasks;
+        bool HistoryPlanned = false;
+        bool HistoryFetched = false;
+        std::size_t InvalidUtf8Messages = 0;
+        TOutputPage Page;
+        TArena PageArena;
+        std::unique_ptr<TDownloadManager> DownloadManager;
+        std::unique_ptr<TMediaStore> MediaStore;
+        std::unique_ptr<TReplyIndexWriter> ReplyIndex;
+        std::unique_ptr<TTextIndexWriter> TextIndex;
+        std::unique_ptr<TRingWriter> Ring;
+        std::unique_ptr<TAsyncWriter> AsyncWriter;
+        std::unique_ptr<TSegmentWriter> Segments;
+        std::vector<TSegmentEntry> SegmentEntries;
+        std::unique_ptr<TDurableOutput> Durable;
+        std::unique_ptr<TPartitionedOutput> Partitions;
+        std::vector<TPartitionFields> PartitionFields;
+        std::unique_ptr<TSqliteStore> Sqlite;
+        std::vector<TStoredMessage> StoredMessages;
+        // Edited messages being fetched, true once they changed again meanwhile
+        std::map<long long, bool> PendingEdits;
+
+        TChatExport(const TChatExport &) = delete;
+        TChatExport &operator = (const TChatExport &) = delete;
+        TChatExport(TChatExport &&) = delete;
+        TChatExport &&operator = (TChatExport &&) = delete;
+
+        void SendQuery(td::td_api::object_ptr<td::td_api::Function> f, std::function<void(Object)> handler);
+        void StartHistory();
+        void ListForumTopics(std::int32_t offsetDate, long long offsetMessageId, long long offsetThreadId);
+        void PlanShards(std::int32_t minDate);
+        void AddHistoryTask(const TMessageFilter &filter, long long threadId, const std::string &name);
+        // Sends next pages of idle history tasks, returns true once all of them are exhausted
+        bool FetchHistory();
+        void FinishHistoryTask(THistoryTask &task);
+        void WriteMessages(THistoryTask &task, THistoryPager::TMessages messages);
+        // Grouped output of a task: moving the buffer into the spill file, writing lines and the spill file out
+        bool SpillGroupedOutput(THistoryTask &task, std::string &error);
+        bool WriteGroupedOutput(const std::string &lines, std::string &error);
+        bool ReplayGroupedOutput(THistoryTask &task, std::string &error);
+        // Handles finished background writes
+        void PumpOutput();
+        // Lines of a grouped task, one record each
+        void WriteRingRecords(const std::string &lines);
+        void ScheduleDownloads(td::td_api::MessageContent &content);
+        void ScheduleDownload(const td::td_api::file &file, std::int32_t priority);
+        void AddReplyEdge(const td::td_api::message &message);
+        // Change log of the followed chat
+        void RequestEdit(long long messageId);
+        void WriteChange(EMessageChange change, td::td_api::message &message);
+        void WriteDeletion(const std::vector<std::int64_t> &messageIds);
+        void WriteChangePage();
+        void FinishIndexes();
+        void FinishOutputs();
+};
@@ -0,0 +1,236 @@
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+#include <td/telegram/td_api.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "chat_lister.h"
+#include "helpers.h"
+
+
+constexpr std::int32_t TChatLister::PageSize;
+
+TChatLister::TChatLister(TQuerySender querySender, const std::string &name, TChatCache &chats, const std::string &manifestPath, std::size_t maxActive)
+    : QuerySender(std::move(querySender))
+    , Name(name)
+    , Chats(chats)
+    , ManifestPath(manifestPath)
+    , MaxActive(maxActive)
+{
+    Lists.emplace_back();
+    Lists.emplace_back();
+    Lists.back().Kind = EListKind::Archive;
+}
+
+void TChatLister::Start() {
+    if (Started)
+        return;
+    Started = true;
+    for (std::size_t i = 0; i < Lists.size(); ++i)
+        LoadNextPage(i);
+}
+
+void TChatLister::AddFolder(std::int32_t folderId) {
+    for (const auto &list : Lists)
+        if (list.Kind == EListKind::Folder && list.FolderId == folderId)
+            return;
+    Lists.emplace_back();
+    Lists.back().Kind = EListKind::Folder;
+    Lists.back().FolderId = folderId;
+    if (Started)
+        LoadNextPage(Lists.size() - 1);
+}
+
+void TChatLister::OnChat(long long chatId) {
+    Listed.insert(chatId);
+}
+
+bool TChatLister::IsDone() const {
+    if (!AreListsLoaded() || !Pending.empty() || Active != 0)
+        return false;
+    return ManifestPath.empty() || LastMessagesRequested;
+}
+
+Json::Value TChatLister::Describe() const {
+    Json::Value result;
+    result["name"] = Name;
+    result["lists"] = Json::Value(Json::arrayValue);
+    for (const auto &list : Lists) {
+        Json::Value item;
+        item["list"] = GetListName(list);
+        item["pages"] = static_cast<Json::UInt64>(list.Pages);
+        item["done"] = list.Done;
+        if (!list.Error.empty())
+            item["error"] = list.Error;
+        result["lists"].append(item);
+    }
+    result["chats"] = static_cast<Json::UInt64>(Listed.size());
+    std::size_t estimated = 0;
+    for (long long chatId : Listed)
+        if (GetMessageCount(chatId) >= 0)
+            ++estimated;
+    result["estimated"] = static_cast<Json::UInt64>(estimated);
+    result["done"] = IsDone();
+    if (ManifestWritten)
+        result["manifest"] = ManifestPath;
+    return result;
+}
+
+void TChatLister::LoadNextPage(std::size_t list) {
+    td::td_api::object_ptr<td::td_api::ChatList> chatList;
+    switch (Lists[list].Kind) {
+        case EListKind::Main:
+            chatList = td::td_api::make_object<td::td_api::chatListMain>();
+            break;
+        case EListKind::Archive:
+            chatList = td::td_api::make_object<td::td_api::chatListArchive>();
+            break;
+        case EListKind::Folder:
+            chatList = td::td_api::make_object<td::td_api::chatListFolder>(Lists[list].FolderId);
+            break;
+    }
+    // Chats of the page arrive as updates before the answer
+    QuerySender(td::td_api::make_object<td::td_api::loadChats>(std::move(chatList), PageSize), [this, list](Object object) {
+        TList &current = Lists[list];
+        if (object->get_id() != td::td_api::error::ID) {
+            ++current.Pages;
+            LoadNextPage(list);
+            return;
+        }
+        const auto &error = static_cast<const td::td_api::error &>(*object);
+        current.Done = true;
+        // 404 means that the whole list is loaded
+        if (error.code_ != 404) {
+            current.Error = error.message_;
+            std::cerr << "Failed to load chat list " << GetListName(current) << " of " << Name << ": " << error.message_ << std::endl;
+        } else {
+            std::cerr << "Chat list " << GetListName(current) << " of " << Name << " is loaded in " << current.Pages << " pages" << std::endl;
+        }
+        FinishIfDone();
+    });
+}
+
+bool TChatLister::AreListsLoaded() const {
+    if (!Started)
+        return false;
+    for (const auto &list : Lists)
+        if (!list.Done)
+            return false;
+    return true;
+}
+
+void TChatLister::RequestLastMessages() {
+    LastMessagesRequested = true;
+    for (long long chatId : Listed) {
+        const TChatRecord *record = Chats.Find(chatId);
+        if (record && (record->Type == EChatType::Supergroup || record->Type == EChatType::Channel) && record->LastMessageId == 0)
+            Pending.push_back(chatId);
+    }
+    SendRequests();
+}
+
+void TChatLister::SendRequests() {
+    while (Active < MaxActive && !Pending.empty()) {
+        const long long chatId = Pending.front();
+        Pending.pop_front();
+        ++Active;
+        QuerySender(td::td_api::make_object<td::td_api::getChatHistory>(chatId, 0, 0, 1, false), [this, chatId](Object object) {
+            --Active;
+            td::td_api::downcast_call(
+                *object, overloaded(
+                    [this, chatId](td::td_api::messages &messages) {
+                        if (!messages.messages_.empty() && messages.messages_.front()) {
+                            TChatRecord &record = Chats.Get(chatId);
+                            record.LastMessageId = std::max<long long>(record.LastMessageId, messages.messages_.front()->id_);
+                        }
+                    },
+                    [](auto &) {
+                    }
+                )
+            );
+            SendRequests();
+            FinishIfDone();
+        });
+    }
+}
+
+long long TChatLister::GetMessageCount(long long chatId) const {
+    const TChatRecord *record = Chats.Find(chatId);
+    if (!record || (record->Type != EChatType::Supergroup && record->Type != EChatType::Channel) || record->LastMessageId <= 0)
+        return -1;
+    // TDLib keeps the server id of a message in the bits above the lowest 20
+    return record->LastMessageId >> 20;
+}
+
+void TChatLister::FinishIfDone() {
+    if (ManifestWritten)
+        return;
+    if (!ManifestPath.empty() && !LastMessagesRequested && AreListsLoaded())
+        RequestLastMessages();
+    if (!IsDone())
+        return;
+    std::cerr << "Chats of " << Name << " are listed: " << Listed.size() << " chats in " << Lists.size() << " lists" << std::endl;
+    if (ManifestPath.empty())
+        return;
+    std::string error;
+    if (WriteManifest(error))
+        std::cerr << "Chat manifest of " << Name << " is written to " << ManifestPath << std::endl;
+    else
+        std::cerr << "Failed to write chat manifest " << ManifestPath << ": " << error << std::endl;
+    ManifestWritten = true;
+}
+
+bool TChatLister::WriteManifest(std::string &error) {
+    // Largest chats first, so that a scheduler starts the longest jobs early, chats without an estimate last
+    std::vector<std::pair<long long, long long>> chats;
+    chats.reserve(Listed.size());
+    for (long long chatId : Listed)
+        chats.emplace_back(GetMessageCount(chatId), chatId);
+    std::sort(chats.begin(), chats.end(), [](const std::pair<long long, long long> &a, const std::pair<long long, long long> &b) {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    });
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    const std::string temporary = ManifestPath + ".tmp";
+    std::ofstream fout(temporary, std::ios::trunc);
+    for (const auto &chat : chats) {
+        Json::Value line;
+        line["chat_id"] = static_cast<Json::Int64>(chat.second);
+        line["message_count"] = chat.first >= 0 ? Json::Value(static_cast<Json::Int64>(chat.first)) : Json::Value();
+        if (const TChatRecord *record = Chats.Find(chat.second)) {
+            line["title"] = record->Title;
+            line["type"] = GetChatTypeName(record->Type);
+            line["last_message_id"] = static_cast<Json::Int64>(record->LastMessageId);
+            line["member_count"] = record->MemberCount;
+        }
+        fout << Json::writeString(builder, line) << '\n';
+    }
+    if (!fout.flush()) {
+        error = "Cannot write " + temporary;
+        return false;
+    }
+    fout.close();
+    if (rename(temporary.c_str(), ManifestPath.c_str()) != 0) {
+        error = "Cannot rename " + temporary + ": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+std::string TChatLister::GetListName(const TList &list) const {
+    switch (list.Kind) {
+        case EListKind::Main:
+            return "main";
+        case EListKind::Archive:
+            return "archive";
+        case EListKind::Folder:
+            return "folder_" + std::to_string(list.FolderId);
+    }
+    return "unknown";
+}
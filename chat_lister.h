@@ -0,0 +1,83 @@
+#pragma once
+
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "chat_cache.h"
+#include "json/json.h"
+
+
+// Enumerates every chat of an account: loadChats is repeated for the main list, the archive and each
+// folder until TDLib answers 404, the lists are loaded side by side. With a manifest path the manifest
+// is written once all lists are loaded. Supergroups and channels number their messages one by one, so
+// the server id of the last message estimates their count; the last messages still unknown then are
+// requested first, at most MaxActive at a time. Other chats have no estimate.
+class TChatLister {
+    public:
+        using Object = td::td_api::object_ptr<td::td_api::Object>;
+        using TQuerySender = std::function<void(td::td_api::object_ptr<td::td_api::Function>, std::function<void(Object)>)>;
+
+        TChatLister(TQuerySender querySender, const std::string &name, TChatCache &chats, const std::string &manifestPath, std::size_t maxActive = 8);
+
+        // Loads the main list, the archive and the folders known so far
+        void Start();
+        // Folders are announced by updates, the ones seen again are ignored
+        void AddFolder(std::int32_t folderId);
+        // A chat with a position in some list
+        void OnChat(long long chatId);
+        bool IsDone() const;
+        Json::Value Describe() const;
+
+    private:
+        static constexpr std::int32_t PageSize = 100;
+
+        enum class EListKind {
+            Main,
+            Archive,
+            Folder
+        };
+
+        struct TList {
+            EListKind Kind = EListKind::Main;
+            std::int32_t FolderId = 0;
+            std::size_t Pages = 0;
+            bool Done = false;
+            std::string Error;
+        };
+
+        TQuerySender QuerySender;
+        std::string Name;
+        TChatCache &Chats;
+        std::string ManifestPath;
+        std::size_t MaxActive;
+        bool Started = false;
+        std::vector<TList> Lists;
+        std::unordered_set<long long> Listed;
+        // Chats waiting for their last message
+        std::deque<long long> Pending;
+        std::size_t Active = 0;
+        bool LastMessagesRequested = false;
+        bool ManifestWritten = false;
+
+        TChatLister(const TChatLister &) = delete;
+        TChatLister &operator = (const TChatLister &) = delete;
+        TChatLister(TChatLister &&) = delete;
+        TChatLister &&operator = (TChatLister &&) = delete;
+
+        void LoadNextPage(std::size_t list);
+        bool AreListsLoaded() const;
+        void RequestLastMessages();
+        void SendRequests();
+        // -1 when the chat does not number its messages or its last message is unknown
+        long long GetMessageCount(long long chatId) const;
+        void FinishIfDone();
+        bool WriteManifest(std::string &error);
+        std::string GetListName(const TList &list) const;
+};
@@ -0,0 +1,95 @@
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+#include <td/telegram/td_api.hpp>
+
+#include <string>
+#include <vector>
+
+#include "content.h"
+#include "helpers.h"
+
+
+TArenaVector<TContentFile> GetContentFiles(td::td_api::MessageContent &content, TArena &arena) {
+    TArenaVector<TContentFile> result(arena);
+    auto add = [&result](const td::td_api::object_ptr<td::td_api::file> &file, std::int32_t priority) {
+        if (file)
+            result.push_back({file.get(), priority});
+    };
+    td::td_api::downcast_call(
+        content, overloaded(
+            [&add](td::td_api::messagePhoto &photo) {
+                if (!photo.photo_)
+                    return;
+                const td::td_api::photoSize *largest = nullptr;
+                for (const auto &size : photo.photo_->sizes_)
+                    if (size && (!largest || size->width_ * size->height_ > largest->width_ * largest->height_))
+                        largest = size.get();
+                if (largest)
+                    add(largest->photo_, 24);
+            },
+            [&add](td::td_api::messageSticker &sticker) {
+                if (sticker.sticker_)
+                    add(sticker.sticker_->sticker_, 20);
+            },
+            [&add](td::td_api::messageVoiceNote &voiceNote) {
+                if (voiceNote.voice_note_)
+                    add(voiceNote.voice_note_->voice_, 16);
+            },
+            [&add](td::td_api::messageAudio &audio) {
+                if (audio.audio_)
+                    add(audio.audio_->audio_, 12);
+            },
+            [&add](td::td_api::messageAnimation &animation) {
+                if (animation.animation_)
+                    add(animation.animation_->animation_, 10);
+            },
+            [&add](td::td_api::messageVideoNote &videoNote) {
+                if (videoNote.video_note_)
+                    add(videoNote.video_note_->video_, 8);
+            },
+            [&add](td::td_api::messageVideo &video) {
+                if (video.video_)
+                    add(video.video_->video_, 4);
+            },
+            [&add](td::td_api::messageDocument &document) {
+                if (document.document_)
+                    add(document.document_->document_, 2);
+            },
+            [](auto &) {
+            }
+        )
+    );
+    return result;
+}
+
+const std::string *GetContentText(td::td_api::MessageContent &content) {
+    const td::td_api::formattedText *text = nullptr;
+    td::td_api::downcast_call(
+        content, overloaded(
+            [&text](td::td_api::messageText &message) {
+                text = message.text_.get();
+            },
+            [&text](td::td_api::messagePhoto &photo) {
+                text = photo.caption_.get();
+            },
+            [&text](td::td_api::messageVideo &video) {
+                text = video.caption_.get();
+            },
+            [&text](td::td_api::messageDocument &document) {
+                text = document.caption_.get();
+            },
+            [&text](td::td_api::messageAudio &audio) {
+                text = audio.caption_.get();
+            },
+            [&text](td::td_api::messageAnimation &animation) {
+                text = animation.caption_.get();
+            },
+            [&text](td::td_api::messageVoiceNote &voiceNote) {
+                text = voiceNote.caption_.get();
+            },
+            [](auto &) {
+            }
+        )
+    );
+    return text ? &text->text_ : nullptr;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "arena.h"
+
+
+struct TContentFile {
+    const td::td_api::file *File;
+    std::int32_t Priority;
+};
+
+// Lists downloadable files of the content together with download priorities
+TArenaVector<TContentFile> GetContentFiles(td::td_api::MessageContent &content, TArena &arena);
+// Text of a text message or caption of a media message, nullptr for other contents
+const std::string *GetContentText(td::td_api::MessageContent &content);
@@ -0,0 +1,138 @@
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+#include <td/telegram/td_api.hpp>
+
+#include <algorithm>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "downloader.h"
+#include "helpers.h"
+
+
+constexpr std::int32_t TDownloadManager::MinPriority;
+constexpr std::int32_t TDownloadManager::MaxPriority;
+
+TDownloadManager::TDownloadManager(TQuerySender querySender, std::size_t maxActive)
+    : QuerySender(std::move(querySender))
+    , MaxActive(maxActive)
+{
+}
+
+void TDownloadManager::Enqueue(std::int32_t fileId, const std::string &uniqueId, std::int32_t priority, TCompletionHandler handler) {
+    const std::string key = uniqueId.empty() ? "file:" + std::to_string(fileId) : uniqueId;
+    auto it = Downloads.find(key);
+    if (it != Downloads.end()) {
+        ++Deduplicated;
+        auto &download = it->second;
+        if (!handler)
+            return;
+        if (download.State == EState::Completed || download.State == EState::Failed)
+            handler(download.Result);
+        else
+            download.Handlers.push_back(std::move(handler));
+        return;
+    }
+    auto &download = Downloads[key];
+    download.Result.FileId = fileId;
+    download.Result.UniqueId = uniqueId;
+    if (handler)
+        download.Handlers.push_back(std::move(handler));
+    Queue.push({std::min(std::max(priority, MinPriority), MaxPriority), NextSequence++, key});
+}
+
+void TDownloadManager::Pump() {
+    while (ActiveFiles.size() < MaxActive && !Queue.empty()) {
+        TQueueItem item = Queue.top();
+        Queue.pop();
+        auto &download = Downloads[item.Key];
+        download.State = EState::Active;
+        std::int32_t fileId = download.Result.FileId;
+        ActiveFiles[fileId] = item.Key;
+        QuerySender(
+            td::td_api::make_object<td::td_api::downloadFile>(fileId, item.Priority, 0, 0, false),
+            [this, alive = std::weak_ptr<bool>(Alive), fileId](Object object) {
+                if (alive.expired())
+                    return;
+                td::td_api::downcast_call(
+                    *object, overloaded(
+                        [this](td::td_api::file &file) {
+                            OnFileUpdate(file);
+                        },
+                        [this, fileId](td::td_api::error &error) {
+                            Finish(fileId, false, error.message_);
+                        },
+                        [](auto &) {
+                        }
+                    )
+                );
+            }
+        );
+    }
+    ReportProgress(false);
+}
+
+void TDownloadManager::OnFileUpdate(const td::td_api::file &file) {
+    auto it = ActiveFiles.find(file.id_);
+    if (it == ActiveFiles.end())
+        return;
+    auto &result = Downloads[it->second].Result;
+    result.Size = file.size_ != 0 ? file.size_ : file.expected_size_;
+    if (result.UniqueId.empty() && file.remote_)
+        result.UniqueId = file.remote_->unique_id_;
+    if (!file.local_)
+        return;
+    result.DownloadedSize = file.local_->downloaded_size_;
+    if (file.local_->is_downloading_completed_) {
+        result.Path = file.local_->path_;
+        Finish(file.id_, true, "");
+    } else if (!file.local_->is_downloading_active_) {
+        Finish(file.id_, false, "Download was stopped");
+    }
+}
+
+bool TDownloadManager::IsIdle() const {
+    return Queue.empty() && ActiveFiles.empty();
+}
+
+void TDownloadManager::Finish(std::int32_t fileId, bool ok, const std::string &error) {
+    auto it = ActiveFiles.find(fileId);
+    if (it == ActiveFiles.end())
+        return;
+    auto &download = Downloads[it->second];
+    ActiveFiles.erase(it);
+    download.State = ok ? EState::Completed : EState::Failed;
+    download.Result.Ok = ok;
+    download.Result.Error = error;
+    if (ok) {
+        ++Completed;
+        CompletedBytes += download.Result.DownloadedSize;
+    } else {
+        ++Failed;
+    }
+    auto handlers = std::move(download.Handlers);
+    download.Handlers.clear();
+    for (const auto &handler : handlers)
+        handler(download.Result);
+    ReportProgress(IsIdle());
+}
+
+void TDownloadManager::ReportProgress(bool force) {
+    time_t ts = time(nullptr);
+    if (!force && ts < LastReport + 5)
+        return;
+    if (!force && ActiveFiles.empty() && Queue.empty())
+        return;
+    LastReport = ts;
+    std::int64_t activeBytes = 0, activeTotal = 0;
+    for (const auto &item : ActiveFiles) {
+        const auto &result = Downloads[item.second].Result;
+        activeBytes += result.DownloadedSize;
+        activeTotal += result.Size;
+    }
+    std::cerr << "Downloads: " << ActiveFiles.size() << " active (" << activeBytes << '/' << activeTotal << " bytes), "
+              << Queue.size() << " queued, " << Completed << " completed (" << CompletedBytes << " bytes), "
+              << Failed << " failed, " << Deduplicated << " deduplicated" << std::endl;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <list>
+#include <memory>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// Downloads files through TDLib keeping at most MaxActive downloads in flight.
+// Requests are deduplicated by remote unique id and served in priority order.
+class TDownloadManager {
+    public:
+        using Object = td::td_api::object_ptr<td::td_api::Object>;
+        using TQuerySender = std::function<void(td::td_api::object_ptr<td::td_api::Function>, std::function<void(Object)>)>;
+
+        struct TResult {
+            std::int32_t FileId = 0;
+            std::string UniqueId;
+            std::string Path;
+            std::int64_t Size = 0;
+            std::int64_t DownloadedSize = 0;
+            bool Ok = false;
+            std::string Error;
+        };
+        using TCompletionHandler = std::function<void(const TResult &result)>;
+
+        // TDLib accepts priorities from 1 to 32, higher ones are downloaded first
+        static constexpr std::int32_t MinPriority = 1;
+        static constexpr std::int32_t MaxPriority = 32;
+
+        TDownloadManager(TQuerySender querySender, std::size_t maxActive);
+
+        void Enqueue(std::int32_t fileId, const std::string &uniqueId, std::int32_t priority, TCompletionHandler handler);
+        void Pump();
+        void OnFileUpdate(const td::td_api::file &file);
+        bool IsIdle() const;
+
+    private:
+        enum class EState {
+            Queued,
+            Active,
+            Completed,
+            Failed
+        };
+
+        struct TDownload {
+            EState State = EState::Queued;
+            TResult Result;
+            std::list<TCompletionHandler> Handlers;
+        };
+
+        struct TQueueItem {
+            std::int32_t Priority;
+            std::uint64_t Sequence;
+            std::string Key;
+
+            bool operator < (const TQueueItem &other) const {
+                if (Priority != other.Priority)
+                    return Priority < other.Priority;
+                return Sequence > other.Sequence;
+            }
+        };
+
+        TQuerySender QuerySender;
+        std::size_t MaxActive;
+        std::uint64_t NextSequence = 0;
+        std::unordered_map<std::string, TDownload> Downloads;
+        std::unordered_map<std::int32_t, std::string> ActiveFiles;
+        std::priority_queue<TQueueItem> Queue;
+        std::size_t Completed = 0;
+        std::size_t Failed = 0;
+        std::size_t Deduplicated = 0;
+        std::int64_t CompletedBytes = 0;
+        time_t LastReport = 0;
+        // Replies to downloadFile may come after the manager is destroyed, they hold a weak reference to it
+        std::shared_ptr<bool> Alive = std::make_shared<bool>(true);
+
+        TDownloadManager(const TDownloadManager &) = delete;
+        TDownloadManager &operator = (const TDownloadManager &) = delete;
+        TDownloadManager(TDownloadManager &&) = delete;
+        TDownloadManager &&operator = (TDownloadManager &&) = delete;
+
+        void Finish(std::int32_t fileId, bool ok, const std::string &error);
+        void ReportProgress(bool force);
+};
@@ -0,0 +1,200 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "durable_output.h"
+#include "json/json.h"
+#include "output_page.h"
+
+
+namespace {
+    std::string GetDirectory(const std::string &path) {
+        const std::size_t slash = path.rfind('/');
+        if (slash == std::string::npos)
+            return ".";
+        return slash == 0 ? "/" : path.substr(0, slash);
+    }
+
+    // Makes a rename in the directory durable
+    bool SyncDirectory(const std::string &path) {
+        const int fd = open(GetDirectory(path).c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+        const bool ok = fsync(fd) == 0;
+        close(fd);
+        return ok;
+    }
+}
+
+
+TDurableOutput::TDurableOutput(const std::string &path, std::size_t groupBytes, std::int64_t groupMilliseconds)
+    : Path(path)
+    , GroupBytes(groupBytes)
+    , GroupInterval(groupMilliseconds)
+{
+}
+
+TDurableOutput::~TDurableOutput() {
+    std::string error;
+    if (Fd >= 0 && !Commit(error))
+        std::cerr << "Output " << Path << ": " << error << std::endl;
+    if (Fd >= 0)
+        close(Fd);
+}
+
+bool TDurableOutput::Open(std::string &error) {
+    bool exists = false;
+    if (!LoadCheckpoint(exists, error))
+        return false;
+    Fd = open(Path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (Fd < 0) {
+        error = "Cannot open " + Path + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(Fd, &st) != 0) {
+        error = "Cannot stat " + Path + ": " + strerror(errno);
+        return false;
+    }
+    // A file written without a checkpoint is not cut, it may be something else entirely
+    if (!exists && st.st_size != 0) {
+        error = Path + " exists but has no checkpoint";
+        return false;
+    }
+    if (st.st_size < DurableSize) {
+        error = Path + " is shorter than its checkpoint";
+        return false;
+    }
+    if (st.st_size > DurableSize) {
+        if (ftruncate(Fd, DurableSize) != 0 || fdatasync(Fd) != 0) {
+            error = "Cannot repair " + Path + ": " + strerror(errno);
+            return false;
+        }
+        std::cerr << "Dropped " << st.st_size - DurableSize << " bytes written to " << Path << " after its last commit" << std::endl;
+    }
+    if (lseek(Fd, DurableSize, SEEK_SET) < 0) {
+        error = "Cannot seek " + Path + ": " + strerror(errno);
+        return false;
+    }
+    Size = DurableSize;
+    Progress = DurableProgress;
+    GroupStart = std::chrono::steady_clock::now();
+    return true;
+}
+
+bool TDurableOutput::GetProgress(const std::string &task, TTaskProgress &progress) const {
+    auto it = DurableProgress.find(task);
+    if (it == DurableProgress.end())
+        return false;
+    progress = it->second;
+    return true;
+}
+
+bool TDurableOutput::Write(const TOutputPage &page, std::string &error) {
+    if (!page.WriteTo(Fd, error)) {
+        error = "Cannot write " + Path + ": " + error;
+        return false;
+    }
+    if (!Dirty)
+        GroupStart = std::chrono::steady_clock::now();
+    Size += static_cast<std::int64_t>(page.GetSize());
+    Dirty = true;
+    return true;
+}
+
+void TDurableOutput::SetProgress(const std::string &task, const TTaskProgress &progress) {
+    if (!Dirty)
+        GroupStart = std::chrono::steady_clock::now();
+    Progress[task] = progress;
+    Dirty = true;
+}
+
+bool TDurableOutput::Pump(std::string &error) {
+    if (!Dirty)
+        return true;
+    const bool due = static_cast<std::size_t>(Size - DurableSize) >= GroupBytes
+        || std::chrono::steady_clock::now() - GroupStart >= GroupInterval;
+    return !due || Commit(error);
+}
+
+bool TDurableOutput::Commit(std::string &error) {
+    if (!Dirty)
+        return true;
+    // Data first: the checkpoint never points past what is on disk
+    if (fdatasync(Fd) != 0) {
+        error = "Cannot sync " + Path + ": " + strerror(errno);
+        return false;
+    }
+    if (!WriteCheckpoint(error))
+        return false;
+    DurableSize = Size;
+    DurableProgress = Progress;
+    Dirty = false;
+    return true;
+}
+
+bool TDurableOutput::LoadCheckpoint(bool &exists, std::string &error) {
+    std::ifstream fin(Path + ".checkpoint");
+    exists = static_cast<bool>(fin);
+    if (!exists)
+        return true;
+    Json::Value checkpoint;
+    Json::Reader reader;
+    if (!reader.parse(fin, checkpoint) || !checkpoint.isObject()) {
+        error = "Malformed checkpoint " + Path + ".checkpoint";
+        return false;
+    }
+    DurableSize = checkpoint["size"].asInt64();
+    const Json::Value &tasks = checkpoint["tasks"];
+    for (const auto &name : tasks.getMemberNames()) {
+        const Json::Value &item = tasks[name];
+        TTaskProgress &progress = DurableProgress[name];
+        progress.MinDate = item["min_date"].asInt();
+        progress.MaxDate = item["max_date"].asInt();
+        progress.ThreadId = item["thread_id"].asInt64();
+        progress.LastMessageId = item["last_message_id"].asInt64();
+        progress.Finished = item["finished"].asBool();
+    }
+    return true;
+}
+
+bool TDurableOutput::WriteCheckpoint(std::string &error) {
+    Json::Value checkpoint;
+    checkpoint["size"] = static_cast<Json::Int64>(Size);
+    Json::Value &tasks = checkpoint["tasks"];
+    tasks = Json::Value(Json::objectValue);
+    for (const auto &item : Progress) {
+        Json::Value task;
+        task["min_date"] = item.second.MinDate;
+        task["max_date"] = item.second.MaxDate;
+        task["thread_id"] = static_cast<Json::Int64>(item.second.ThreadId);
+        task["last_message_id"] = static_cast<Json::Int64>(item.second.LastMessageId);
+        task["finished"] = item.second.Finished;
+        tasks[item.first] = task;
+    }
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    const std::string data = Json::writeString(builder, checkpoint) + "\n";
+
+    const std::string path = Path + ".checkpoint";
+    const int fd = open((path + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = "Cannot write " + path + ": " + strerror(errno);
+        return false;
+    }
+    const bool written = write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size()) && fdatasync(fd) == 0;
+    const int savedErrno = errno;
+    close(fd);
+    if (!written || rename((path + ".tmp").c_str(), path.c_str()) != 0 || !SyncDirectory(path)) {
+        error = "Cannot write " + path + ": " + strerror(written ? errno : savedErrno);
+        return false;
+    }
+    return true;
+}
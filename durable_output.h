@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "output_page.h"
+
+
+// Progress of one history task as recorded in the checkpoint
+struct TTaskProgress {
+    // Bounds of the task, progress only carries over to a task with the same ones
+    std::int32_t MinDate = 0;
+    std::int32_t MaxDate = 0;
+    long long ThreadId = 0;
+    // The oldest message written, paging resumes after it
+    long long LastMessageId = 0;
+    bool Finished = false;
+};
+
+// Output file with group commit. Pages are appended with writev and made durable in groups: one fdatasync
+// of the file followed by an atomic rewrite of PATH.checkpoint, which records the durable length and the
+// progress of every task. Opening an existing file cuts it back to the durable length, so a torn or unsynced
+// tail of a crashed run is dropped and its tasks resume after their last durable message.
+class TDurableOutput {
+    public:
+        // A group is committed once it holds groupBytes or is groupMilliseconds old
+        TDurableOutput(const std::string &path, std::size_t groupBytes = 16 << 20, std::int64_t groupMilliseconds = 1000);
+        ~TDurableOutput();
+
+        bool Open(std::string &error);
+        // Durable progress of the task, false when the checkpoint has none
+        bool GetProgress(const std::string &task, TTaskProgress &progress) const;
+        bool Write(const TOutputPage &page, std::string &error);
+        // Progress covering everything written so far, it becomes durable with the next commit
+        void SetProgress(const std::string &task, const TTaskProgress &progress);
+        // Commits the group if it is due
+        bool Pump(std::string &error);
+        bool Commit(std::string &error);
+
+    private:
+        std::string Path;
+        std::size_t GroupBytes;
+        std::chrono::milliseconds GroupInterval;
+        int Fd = -1;
+        std::int64_t Size = 0;
+        std::int64_t DurableSize = 0;
+        std::map<std::string, TTaskProgress> Progress;
+        std::map<std::string, TTaskProgress> DurableProgress;
+        bool Dirty = false;
+        std::chrono::steady_clock::time_point GroupStart;
+
+        TDurableOutput(const TDurableOutput &) = delete;
+        TDurableOutput &operator = (const TDurableOutput &) = delete;
+        TDurableOutput(TDurableOutput &&) = delete;
+        TDurableOutput &&operator = (TDurableOutput &&) = delete;
+
+        bool LoadCheckpoint(bool &exists, std::string &error);
+        bool WriteCheckpoint(std::string &error);
+};
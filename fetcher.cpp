@@ -3,19 +3,26 @@
 #include <td/telegram/td_api.hpp>
 #include <td/telegram/td_json_client.h>
 
+#include <algorithm>
 #include <ctime>
 #include <fstream>
 #include <functional>
 #include <iostream>
 #include <map>
 #include <memory>
+#include <stdexcept>
 #include <sstream>
 #include <string>
 #include <vector>
 
+#include "chat_cache.h"
+#include "chat_export.h"
+#include "chat_lister.h"
 #include "helpers.h"
+#include "job_server.h"
 #include "json/json.h"
 #include "fetcher.h"
+#include "options.h"
 #include "requests.h"
 
 
@@ -38,6 +45,68 @@ std::shared_ptr<TChatFetcher> &TChatFetcher::InstancePrivate() {
     return Global;
 }
 
+namespace {
+    const char *GetJobStateName(EJobState state) {
+        switch (state) {
+            case EJobState::Queued:
+                return "queued";
+            case EJobState::Running:
+                return "running";
+            case EJobState::Stopping:
+                return "stopping";
+            case EJobState::Done:
+                return "done";
+            case EJobState::Cancelled:
+                return "cancelled";
+            case EJobState::Failed:
+                return "failed";
+        }
+        return "unknown";
+    }
+
+    // Files and directories written by a job, stdout included. Jobs sharing one of them run one after another.
+    std::vector<std::string> GetOutputTargets(const TOptions &options) {
+        const std::string chat = "/chat_" + std::to_string(options.ChatId);
+        std::vector<std::string> targets;
+        if (!options.ShardDirectory.empty())
+            targets.push_back(options.ShardDirectory);
+        else if (!options.SegmentDirectory.empty())
+            targets.push_back(options.SegmentDirectory + chat);
+        else if (!options.PartitionDirectory.empty())
+            targets.push_back(options.PartitionDirectory + chat);
+        else if (!options.SqlitePath.empty())
+            targets.push_back(options.SqlitePath);
+        else if (!options.OutputPath.empty())
+            targets.push_back(options.OutputPath);
+        else if (!options.RingPath.empty())
+            targets.push_back(options.RingPath);
+        else
+            targets.push_back("/dev/stdout");
+        if (!options.ReplyIndexDirectory.empty())
+            targets.push_back(options.ReplyIndexDirectory);
+        if (!options.TextIndexDirectory.empty())
+            targets.push_back(options.TextIndexDirectory);
+        if (options.DownloadMedia)
+            targets.push_back(options.MediaDirectory);
+        return targets;
+    }
+
+    EChatType GetChatType(const td::td_api::ChatType &type) {
+        switch (type.get_id()) {
+            case td::td_api::chatTypePrivate::ID:
+                return EChatType::Private;
+            case td::td_api::chatTypeBasicGroup::ID:
+                return EChatType::BasicGroup;
+            case td::td_api::chatTypeSupergroup::ID:
+                return static_cast<const td::td_api::chatTypeSupergroup &>(type).is_channel_ ? EChatType::Channel : EChatType::Supergroup;
+            case td::td_api::chatTypeSecret::ID:
+                return EChatType::Secret;
+        }
+        return EChatType::Unknown;
+    }
+}
+
+
 TChatFetcher::TChatFetcher(const Json::Value &secrets)
     : Secrets(secrets)
     , Exit(false)
@@ -45,137 +114,79 @@ TChatFetcher::TChatFetcher(const Json::Value &secrets)
 {
     td::ClientManager::execute(td::td_api::make_object<td::td_api::setLogVerbosityLevel>(2));
     ClientManager = std::make_unique<td::ClientManager>();
-    ClientId = ClientManager->create_client_id();
-    SendQuery(td::td_api::make_object<td::td_api::getOption>("version"), {});
+    // Accounts override the shared secrets, e.g. {"api_id": ..., "accounts": [{"phone": ..., "db": ...}, ...]}
+    const Json::Value &accounts = Secrets["accounts"];
+    if (accounts.isArray() && !accounts.empty()) {
+        for (Json::ArrayIndex i = 0; i < accounts.size(); ++i) {
+            Json::Value merged = Secrets;
+            merged.removeMember("accounts");
+            for (const auto &name : accounts[i].getMemberNames())
+                merged[name] = accounts[i][name];
+            if (!accounts[i].isMember("db"))
+                merged["db"] = Secrets["db"].asString() + "/account_" + std::to_string(i);
+            Accounts.emplace_back();
+            Accounts.back().Secrets = merged;
+        }
+    } else {
+        Accounts.emplace_back();
+        Accounts.back().Secrets = Secrets;
+    }
+    for (std::size_t i = 0; i < Accounts.size(); ++i) {
+        // Chats of the previous run are known before TDLib sends them again
+        Accounts[i].Chats = std::make_unique<TChatCache>(Accounts[i].Secrets["db"].asString() + "/chat_cache.bin");
+        std::string error;
+        if (!Accounts[i].Chats->Load(error))
+            std::cerr << "Ignoring chat cache: " << error << std::endl;
+        Accounts[i].ClientId = ClientManager->create_client_id();
+        SendQuery(i, td::td_api::make_object<td::td_api::getOption>("version"), {});
+    }
 }
 
 TChatFetcher::~TChatFetcher() {
+    // Outputs of interrupted jobs are written out before the clients go away
+    Jobs.clear();
 }
 
-Json::Value TChatFetcher::ParseSender(td::td_api::MessageSender &sender) {
-    Json::Value result;
-    td::td_api::downcast_call(
-        sender, overloaded(
-            [&result](td::td_api::messageSenderChat &chat) {
-                result["type"] = "chat";
-                result["chat_id"] = static_cast<long long>(chat.chat_id_);
+void TChatFetcher::Main(const TOptions &options) {
+    Verbose = options.Verbose;
+    for (std::size_t i = 0; i < Accounts.size(); ++i) {
+        std::string manifestPath = options.ChatManifestPath;
+        if (!manifestPath.empty() && Accounts.size() > 1)
+            manifestPath += "." + std::to_string(i);
+        Accounts[i].Lister = std::make_unique<TChatLister>(
+            [this, i](td::td_api::object_ptr<td::td_api::Function> f, std::function<void(Object)> handler) {
+                SendQuery(i, std::move(f), std::move(handler));
             },
-            [&result](td::td_api::messageSenderUser &user) {
-                result["type"] = "user";
-                result["user_id"] = static_cast<long long>(user.user_id_);
-            },
-            [&result](auto &) {
-                result["type"] = "unknown";
-            }
-        )
-    );
-    return result;
-}
-
-Json::Value TChatFetcher::ParseContent(td::td_api::MessageContent &content) {
-    Json::Value result;
-    td::td_api::downcast_call(
-        content, overloaded(
-            [&result](td::td_api::messageText &text) {
-                result["type"] = "text";
-                if (text.text_)
-                    result["text"] = text.text_->text_;
-            },
-            [&result](td::td_api::messageVoiceNote &voiceNote) {
-                result["type"] = "voice_note";
-                if (voiceNote.voice_note_ && voiceNote.voice_note_->voice_) {
-                    if (voiceNote.voice_note_->voice_->remote_)
-                        result["remote_file_id"] = voiceNote.voice_note_->voice_->remote_->id_;
-                    result["file_id"] = voiceNote.voice_note_->voice_->id_;
-                }
-            },
-            [&result](td::td_api::messageVideoNote &videoNote) {
-                result["type"] = "video_note";
-                if (videoNote.video_note_ && videoNote.video_note_->video_) {
-                    if (videoNote.video_note_->video_->remote_)
-                        result["remote_file_id"] = videoNote.video_note_->video_->remote_->id_;
-                    result["file_id"] = videoNote.video_note_->video_->id_;
-                }
-            },
-            [&result](auto &) {
-                result["type"] = "unknown";
-            }
-        )
-    );
-    return result;
-}
-
-Json::Value TChatFetcher::ParseMessage(td::td_api::message &message) {
-    Json::Value result;
-    result["id"] = static_cast<long long>(message.id_);
-    if (message.reply_to_)
-        td::td_api::downcast_call(
-            *message.reply_to_, overloaded(
-                [&result](td::td_api::messageReplyToMessage &reply) {
-                    result["reply_to_chat_id"] = static_cast<long long>(reply.chat_id_);
-                    result["reply_to_message_id"] = static_cast<long long>(reply.message_id_);
-                },
-                [](auto &) {
-                }
-            )
+            "account " + std::to_string(i), *Accounts[i].Chats, manifestPath
         );
-    result["message_thread_id"] = static_cast<long long>(message.message_thread_id_);
-    result["date"] = message.date_;
-    result["edit_date"] = message.edit_date_;
-    if (message.sender_id_)
-        result["sender"] = ParseSender(*message.sender_id_);
-    if (message.content_)
-        result["content"] = ParseContent(*message.content_);
-    return result;
-}
-
-void TChatFetcher::Main(long long chatId) {
+    }
+    if (!options.DaemonSocket.empty()) {
+        JobServer = std::make_unique<TJobServer>(options.DaemonSocket, [this](const Json::Value &request) {
+            return HandleJobRequest(request);
+        });
+        std::string error;
+        if (!JobServer->Open(error)) {
+            std::cerr << "Failed to start the daemon: " << error << std::endl;
+            return;
+        }
+        std::cerr << "Accepting jobs on " << options.DaemonSocket << std::endl;
+    } else {
+        Jobs[NextJobId++].Options = options;
+    }
     BotProcessor = std::make_unique<TBotProcessor>(Secrets["bot_token"].asString(), 120, 1);
     BotProcessor->Run();
-    bool chatsLoaded = false, fetchingHistory = false;
-    long long lastMessageId = 0;
     while (!IsExit()) {
-        if (!IsAuthorised) {
+        if (JobServer)
+            JobServer->Pump();
+        // Jobs start once some account is ready, the others keep authorising meanwhile
+        if (!IsAnyAuthorised()) {
             ProcessResponse(ClientManager->receive(1.0));
-        } else if (!chatsLoaded) {
-            chatsLoaded = true;
-            std::cerr << "Loading chat list..." << std::endl;
-            SendQuery(td::td_api::make_object<td::td_api::loadChats>(nullptr, 100), [this](Object object) {
-                if (object->get_id() == td::td_api::error::ID) {
-                    return;
-                }
-                std::cerr << "Chats loaded" << std::endl;
-            });
-            std::cerr << "Starting fetching history for the chat_id " << chatId << std::endl;
-            /*for (long long messageId : {}) {
-                SendQuery(td::td_api::make_object<td::td_api::getMessage>(, messageId), [this](Object object) {
-                    td::td_api::downcast_call(
-                        *object, overloaded(
-                            [this](td::td_api::message &message) {
-                                auto &video = static_cast<td::td_api::messageVideo&>(*message.content_);
-                                SendQuery(td::td_api::make_object<td::td_api::downloadFile>(video.video_->video_->id_, 1, 0, 0, true), [this](Object object) {
-                                //SendQuery(td::td_api::make_object<td::td_api::getFileFile>(videoNote.video_note_->video_->id_), [this](Object object) {
-                                    td::td_api::downcast_call(
-                                        *object, overloaded(
-                                            [](td::td_api::file &file) {
-                                                std::cout << file.local_->path_ << std::endl;
-                                            },
-                                            [](td::td_api::error &error) {
-                                                std::cout << error.message_ << std::endl;
-                                            },
-                                            [](auto &) {
-                                                std::cout << "failed to download file" << std::endl;
-                                            }
-                                        )
-                                    );
-                                });
-                            },
-                            [](auto &) {
-                            }
-                        )
-                    );
-                });
-            }*/
+        } else if (StartJobs(), !HasActiveJobs()) {
+            // A daemon waits for jobs, a single export is over once no job is left
+            if (!JobServer && !HasQueuedJobs())
+                SetExit();
+            else
+                ProcessResponse(ClientManager->receive(0.1));
         } else {
             while (!Exit) {
                 auto response = ClientManager->receive(0.01);
@@ -184,40 +195,205 @@ void TChatFetcher::Main(long long chatId) {
                 } else {
                     break;
                 }
-                if (!fetchingHistory) {
-                    fetchingHistory = true;
-                    SendQuery(td::td_api::make_object<td::td_api::getChatHistory>(chatId, lastMessageId, 0, 100, false), [this, &lastMessageId, &fetchingHistory](Object object) {
-                        td::td_api::downcast_call(
-                            *object, overloaded(
-                                [this, &lastMessageId](td::td_api::messages &messages) {
-                                    if (messages.total_count_ == 0) {
-                                        SetExit();
-                                        return;
-                                    }
-                                    for (auto &message : messages.messages_) {
-                                        Json::Value item = ParseMessage(*message);
-                                        Json::StreamWriterBuilder builder;
-                                        builder["indentation"] = "";
-                                        std::cout << Json::writeString(builder, item) << std::endl;
-                                        lastMessageId = message->id_;
-                                    }
-                                    //std::cout << std::endl;
-                                },
-                                [](auto &) {
-                                }
-                            )
-                        );
-                        fetchingHistory = false;
-                    });
-                }
+                PumpJobs();
             }
+            PumpJobs();
         }
     }
+    // An interrupted export still gets indexes of everything written so far
+    for (auto &item : Jobs)
+        if (item.second.Export)
+            FinishJob(item.first, item.second, item.second.Export->GetError().empty() ? EJobState::Cancelled : EJobState::Failed);
+    JobServer.reset();
+    SaveChatCaches();
     BotProcessor->SetExit();
     BotProcessor->Join();
     BotProcessor.reset(nullptr);
 }
 
+void TChatFetcher::StartJobs() {
+    for (auto &item : Jobs) {
+        if (item.second.State != EJobState::Queued)
+            continue;
+        // A job pinned to an account waits for it, the others take the least used idle account
+        const TOptions &options = item.second.Options;
+        std::size_t account = Accounts.size();
+        if (options.Account >= 0) {
+            if (static_cast<std::size_t>(options.Account) >= Accounts.size()) {
+                item.second.State = EJobState::Failed;
+                item.second.Error = "No account " + std::to_string(options.Account);
+                continue;
+            }
+            if (Accounts[options.Account].IsAuthorised && Accounts[options.Account].JobId == 0)
+                account = static_cast<std::size_t>(options.Account);
+        } else {
+            for (std::size_t i = 0; i < Accounts.size(); ++i)
+                if (Accounts[i].IsAuthorised && Accounts[i].JobId == 0 && (account == Accounts.size() || Accounts[i].Jobs < Accounts[account].Jobs))
+                    account = i;
+        }
+        if (account == Accounts.size() || IsOutputBusy(options))
+            continue;
+        StartJob(item.first, item.second, account);
+    }
+}
+
+void TChatFetcher::StartJob(std::uint64_t id, TJob &job, std::size_t account) {
+    ++Accounts[account].Jobs;
+    Accounts[account].JobId = id;
+    job.Account = account;
+    job.State = EJobState::Running;
+    job.Export = std::make_unique<TChatExport>(
+        [this, account](td::td_api::object_ptr<td::td_api::Function> f, std::function<void(Object)> handler) {
+            SendQuery(account, std::move(f), std::move(handler));
+        },
+        job.Options, account, &Exit
+    );
+    std::string error;
+    if (!job.Export->Start(error)) {
+        job.Error = error;
+        std::cerr << error << std::endl;
+        FinishJob(id, job, EJobState::Failed);
+        if (!JobServer)
+            SetExit();
+    }
+}
+
+bool TChatFetcher::IsOutputBusy(const TOptions &options) const {
+    const std::vector<std::string> targets = GetOutputTargets(options);
+    for (const auto &item : Jobs) {
+        if (!item.second.Export)
+            continue;
+        for (const auto &target : GetOutputTargets(item.second.Options))
+            if (std::find(targets.begin(), targets.end(), target) != targets.end())
+                return true;
+    }
+    return false;
+}
+
+bool TChatFetcher::HasActiveJobs() const {
+    for (const auto &account : Accounts)
+        if (account.JobId != 0)
+            return true;
+    return false;
+}
+
+bool TChatFetcher::HasQueuedJobs() const {
+    for (const auto &item : Jobs)
+        if (item.second.State == EJobState::Queued)
+            return true;
+    return false;
+}
+
+void TChatFetcher::PumpJobs() {
+    for (auto &item : Jobs) {
+        TJob &job = item.second;
+        if (!job.Export)
+            continue;
+        job.Export->Pump();
+        if (job.Export->IsComplete()) {
+            FinishJob(item.first, job, EJobState::Done);
+        } else if (!job.Export->IsRunning()) {
+            // Responses to requests of the job must not outlive its state
+            job.State = EJobState::Stopping;
+            const bool failed = !job.Export->GetError().empty();
+            if (!job.Export->HasPendingQueries())
+                FinishJob(item.first, job, failed ? EJobState::Failed : EJobState::Cancelled);
+            if (failed && !JobServer)
+                SetExit();
+        }
+    }
+}
+
+void TChatFetcher::FinishJob(std::uint64_t id, TJob &job, EJobState state) {
+    job.Export->Finish();
+    job.Messages = job.Export->GetMessageCount();
+    if (job.Error.empty())
+        job.Error = job.Export->GetError();
+    job.Export.reset();
+    Accounts[job.Account].JobId = 0;
+    SaveChatCaches();
+    job.State = state;
+    std::cerr << "Job " << id << " is " << GetJobStateName(state) << std::endl;
+}
+
+Json::Value TChatFetcher::HandleJobRequest(const Json::Value &request) {
+    Json::Value response;
+    response["ok"] = true;
+    const std::string command = request["command"].asString();
+    const std::uint64_t id = request["job"].asUInt64();
+    auto it = Jobs.find(id);
+    if (command == "submit") {
+        if (!request["args"].isArray()) {
+            response["ok"] = false;
+            response["error"] = "Missing args";
+            return response;
+        }
+        std::vector<std::string> args = {"fetcher"};
+        for (const auto &arg : request["args"])
+            args.push_back(arg.asString());
+        std::vector<char *> argv;
+        for (auto &arg : args)
+            argv.push_back(&arg[0]);
+        TOptions options;
+        try {
+            options = ParseOptions(static_cast<int>(argv.size()), argv.data());
+            if (!options.DaemonSocket.empty())
+                throw std::invalid_argument("A job cannot start a daemon");
+            // A followed chat never finishes, so it would hold back every job after it
+            if (options.Follow)
+                throw std::invalid_argument("--follow is not supported by the daemon, follow a chat with a separate fetcher");
+        } catch (const std::exception &ex) {
+            response["ok"] = false;
+            response["error"] = ex.what();
+            return response;
+        }
+        Jobs[NextJobId].Options = options;
+        response["job"] = static_cast<Json::UInt64>(NextJobId++);
+    } else if (command == "list") {
+        response["jobs"] = Json::Value(Json::arrayValue);
+        for (const auto &item : Jobs)
+            response["jobs"].append(DescribeJob(item.first, item.second));
+    } else if (command == "chats") {
+        response["accounts"] = Json::Value(Json::arrayValue);
+        for (const auto &account : Accounts)
+            response["accounts"].append(account.Lister->Describe());
+    } else if ((command == "status" || command == "cancel") && it == Jobs.end()) {
+        response["ok"] = false;
+        response["error"] = "Unknown job";
+    } else if (command == "status") {
+        response["job"] = DescribeJob(it->first, it->second);
+    } else if (command == "cancel") {
+        if (it->second.State == EJobState::Queued)
+            it->second.State = EJobState::Cancelled;
+        else if (it->second.Export) {
+            it->second.Export->Stop();
+            it->second.State = EJobState::Stopping;
+        } else {
+            response["ok"] = false;
+            response["error"] = "Job is already over";
+        }
+        response["job"] = DescribeJob(it->first, it->second);
+    } else {
+        response["ok"] = false;
+        response["error"] = "Unknown command " + command + ", expected submit, status, cancel, list or chats";
+    }
+    return response;
+}
+
+Json::Value TChatFetcher::DescribeJob(std::uint64_t id, const TJob &job) const {
+    Json::Value result;
+    result["id"] = static_cast<Json::UInt64>(id);
+    result["state"] = GetJobStateName(job.State);
+    result["chat_id"] = static_cast<Json::Int64>(job.Options.ChatId);
+    result["messages"] = static_cast<Json::UInt64>(job.Export ? job.Export->GetMessageCount() : job.Messages);
+    if (job.State != EJobState::Queued)
+        result["account"] = static_cast<Json::UInt64>(job.Account);
+    const std::string &error = job.Export ? job.Export->GetError() : job.Error;
+    if (!error.empty())
+        result["error"] = error;
+    return result;
+}
+
 bool TChatFetcher::IsExit() const {
     if (Exit)
         return true;
@@ -231,12 +407,12 @@ void TChatFetcher::SetExit() {
     Exit = true;
 }
 
-void TChatFetcher::SendQuery(td::td_api::object_ptr<td::td_api::Function> f, std::function<void(Object)> handler) {
+void TChatFetcher::SendQuery(std::size_t account, td::td_api::object_ptr<td::td_api::Function> f, std::function<void(Object)> handler) {
     auto query_id = NextQueryId();
     if (handler) {
-        Handlers.emplace(query_id, std::move(handler));
+        Accounts[account].Handlers.emplace(query_id, std::move(handler));
     }
-    ClientManager->send(ClientId, query_id, std::move(f));
+    ClientManager->send(Accounts[account].ClientId, query_id, std::move(f));
 }
 
 void TChatFetcher::ProcessResponse(td::ClientManager::Response response) {
@@ -244,121 +420,186 @@ void TChatFetcher::ProcessResponse(td::ClientManager::Response response) {
         return;
     }
     //std::cout << response.request_id << " " << to_string(response.object) << std::endl;
+    std::size_t account = 0;
+    while (account < Accounts.size() && Accounts[account].ClientId != response.client_id)
+        ++account;
+    if (account == Accounts.size())
+        return;
     if (response.request_id == 0) {
-        return ProcessUpdate(std::move(response.object));
+        return ProcessUpdate(account, std::move(response.object));
     }
-    auto it = Handlers.find(response.request_id);
-    if (it != Handlers.end()) {
+    auto &handlers = Accounts[account].Handlers;
+    auto it = handlers.find(response.request_id);
+    if (it != handlers.end()) {
         auto handler = std::move(it->second);
-        Handlers.erase(it);
+        handlers.erase(it);
         handler(std::move(response.object));
     }
 }
 
-void TChatFetcher::ProcessUpdate(td::td_api::object_ptr<td::td_api::Object> update) {
+void TChatFetcher::ProcessUpdate(std::size_t account, td::td_api::object_ptr<td::td_api::Object> update) {
+    // Files, messages and their ids belong to one client, they go to the job running on the account
+    if (Accounts[account].JobId != 0)
+        Jobs[Accounts[account].JobId].Export->OnUpdate(*update);
     td::td_api::downcast_call(
         *update, overloaded(
-            [this](td::td_api::updateAuthorizationState &update_authorization_state) {
-                AuthorisationState = std::move(update_authorization_state.authorization_state_);
-                OnAuthorisationStateUpdate();
+            [this, account](td::td_api::updateAuthorizationState &update_authorization_state) {
+                Accounts[account].AuthorisationState = std::move(update_authorization_state.authorization_state_);
+                OnAuthorisationStateUpdate(account);
+            },
+            [this, account](td::td_api::updateNewChat &update_new_chat) {
+                const auto &chat = *update_new_chat.chat_;
+                if (Verbose)
+                    std::cerr << "New chat: " << chat.id_ << ' ' << chat.title_ << std::endl;
+                TChatRecord &record = Accounts[account].Chats->Get(chat.id_);
+                record.Title = chat.title_;
+                if (chat.type_)
+                    record.Type = GetChatType(*chat.type_);
+                if (chat.last_message_)
+                    record.LastMessageId = chat.last_message_->id_;
+                if (!chat.positions_.empty())
+                    Accounts[account].Lister->OnChat(chat.id_);
+            },
+            [this, account](td::td_api::updateChatPosition &update) {
+                // Order 0 removes the chat from the list
+                if (update.position_ && update.position_->order_ != 0)
+                    Accounts[account].Lister->OnChat(update.chat_id_);
             },
-            [this](td::td_api::updateFile &update) {
-                std::cerr << "Update: " << update.file_->local_->path_ << std::endl;
+            [this, account](td::td_api::updateChatFolders &update) {
+                for (const auto &folder : update.chat_folders_)
+                    if (folder)
+                        Accounts[account].Lister->AddFolder(folder->id_);
             },
-            [this](td::td_api::updateNewChat &update_new_chat) {
-                std::cerr << "New chat: " << update_new_chat.chat_->id_ << ' ' << update_new_chat.chat_->title_ << std::endl;
-                ChatTitles[update_new_chat.chat_->id_] = update_new_chat.chat_->title_;
+            [this, account](td::td_api::updateChatTitle &update_chat_title) {
+                if (Verbose)
+                    std::cerr << "Update title: " << update_chat_title.chat_id_ << ' ' << update_chat_title.title_ << std::endl;
+                Accounts[account].Chats->Get(update_chat_title.chat_id_).Title = update_chat_title.title_;
             },
-            [this](td::td_api::updateChatTitle &update_chat_title) {
-                std::cerr << "Update title: " << update_chat_title.chat_id_ << ' ' << update_chat_title.title_ << std::endl;
-                ChatTitles[update_chat_title.chat_id_] = update_chat_title.title_;
+            [this, account](td::td_api::updateChatLastMessage &update) {
+                // A loaded chat may get its positions with its last message
+                for (const auto &position : update.positions_)
+                    if (position && position->order_ != 0)
+                        Accounts[account].Lister->OnChat(update.chat_id_);
+                if (!update.last_message_)
+                    return;
+                Accounts[account].Chats->Get(update.chat_id_).LastMessageId = update.last_message_->id_;
+            },
+            [this, account](td::td_api::updateBasicGroup &update) {
+                // Chat ids of groups are derived from their own ids
+                if (!update.basic_group_)
+                    return;
+                Accounts[account].Chats->Get(-update.basic_group_->id_).MemberCount = update.basic_group_->member_count_;
+            },
+            [this, account](td::td_api::updateSupergroup &update) {
+                if (!update.supergroup_)
+                    return;
+                TChatRecord &record = Accounts[account].Chats->Get(-1000000000000LL - update.supergroup_->id_);
+                record.MemberCount = update.supergroup_->member_count_;
+                record.Type = update.supergroup_->is_channel_ ? EChatType::Channel : EChatType::Supergroup;
             },
             [](auto &update) {}
         )
     );
 }
 
-auto TChatFetcher::CreateAuthenticationQueryHandler() {
-    return [this, id = AuthenticationQueryId](Object object) {
-        if (id == AuthenticationQueryId) {
-            CheckAuthenticationError(std::move(object));
+bool TChatFetcher::IsAnyAuthorised() const {
+    for (const auto &account : Accounts)
+        if (account.IsAuthorised)
+            return true;
+    return false;
+}
+
+auto TChatFetcher::CreateAuthenticationQueryHandler(std::size_t account) {
+    return [this, account, id = Accounts[account].AuthenticationQueryId](Object object) {
+        if (id == Accounts[account].AuthenticationQueryId) {
+            CheckAuthenticationError(account, std::move(object));
         }
     };
 }
 
-void TChatFetcher::OnAuthorisationStateUpdate() {
-    ++AuthenticationQueryId;
-    td::td_api::downcast_call(*AuthorisationState,
+void TChatFetcher::OnAuthorisationStateUpdate(std::size_t account) {
+    TAccount &state = Accounts[account];
+    const Json::Value &secrets = state.Secrets;
+    // Prompts name the account when there are several
+    const std::string suffix = Accounts.size() > 1 ? " of " + secrets["phone"].asString() : std::string();
+    auto sendCode = [this, account](const Json::Value &response) {
+        SendQuery(
+            account,
+            td::td_api::make_object<td::td_api::checkAuthenticationCode>(response["text"].asString()),
+            CreateAuthenticationQueryHandler(account)
+        );
+    };
+    ++state.AuthenticationQueryId;
+    td::td_api::downcast_call(*state.AuthorisationState,
                 overloaded(
-                    [this](td::td_api::authorizationStateReady &) {
-                        IsAuthorised = true;
-                        std::cerr << "Authorisation is completed" << std::endl;
+                    [account, &state](td::td_api::authorizationStateReady &) {
+                        state.IsAuthorised = true;
+                        std::cerr << "Authorisation of account " << account << " is completed, loading chat lists..." << std::endl;
+                        state.Lister->Start();
                     },
-                    [this](td::td_api::authorizationStateLoggingOut &) {
-                        IsAuthorised = false;
-                        std::cerr << "Logging out" << std::endl;
+                    [account, &state](td::td_api::authorizationStateLoggingOut &) {
+                        state.IsAuthorised = false;
+                        std::cerr << "Account " << account << " is logging out" << std::endl;
                     },
-                    [this](td::td_api::authorizationStateClosing &) { std::cerr << "Closing" << std::endl; },
-                    [this](td::td_api::authorizationStateClosed &) {
-                        IsAuthorised = false;
-                        Exit = true;
-                        std::cerr << "Terminating" << std::endl;
+                    [](td::td_api::authorizationStateClosing &) { std::cerr << "Closing" << std::endl; },
+                    [this, &state](td::td_api::authorizationStateClosed &) {
+                        state.IsAuthorised = false;
+                        state.IsClosed = true;
+                        // The process ends with the last client
+                        bool closed = true;
+                        for (const auto &other : Accounts)
+                            closed = closed && other.IsClosed;
+                        if (closed) {
+                            Exit = true;
+                            std::cerr << "Terminating" << std::endl;
+                        }
                     },
-                    [this](td::td_api::authorizationStateWaitPhoneNumber &) {
+                    [this, account, &secrets](td::td_api::authorizationStateWaitPhoneNumber &) {
                         SendQuery(
-                            td::td_api::make_object<td::td_api::setAuthenticationPhoneNumber>(Secrets["phone"].asString(), nullptr),
-                            CreateAuthenticationQueryHandler()
+                            account,
+                            td::td_api::make_object<td::td_api::setAuthenticationPhoneNumber>(secrets["phone"].asString(), nullptr),
+                            CreateAuthenticationQueryHandler(account)
                         );
                     },
-                    [this](td::td_api::authorizationStateWaitEmailAddress &) {
-                        SendQuery(td::td_api::make_object<td::td_api::setAuthenticationEmailAddress>(Secrets["email"].asString()), CreateAuthenticationQueryHandler());
+                    [this, account, &secrets](td::td_api::authorizationStateWaitEmailAddress &) {
+                        SendQuery(account, td::td_api::make_object<td::td_api::setAuthenticationEmailAddress>(secrets["email"].asString()), CreateAuthenticationQueryHandler(account));
                     },
-                    [this](td::td_api::authorizationStateWaitEmailCode &) {
-                        BotProcessor->SendMessage(Secrets["user_id"].asString(), "Reply with the email authentication code:", [this](const Json::Value &response) {
-                            SendQuery(
-                                td::td_api::make_object<td::td_api::checkAuthenticationCode>(response["text"].asString()),
-                                CreateAuthenticationQueryHandler()
-                            );
-                        });
+                    [this, &secrets, &suffix, &sendCode](td::td_api::authorizationStateWaitEmailCode &) {
+                        BotProcessor->SendMessage(secrets["user_id"].asString(), "Reply with the email authentication code" + suffix + ":", sendCode);
                     },
-                    [this](td::td_api::authorizationStateWaitCode &) {
-                        BotProcessor->SendMessage(Secrets["user_id"].asString(), "Reply with the authentication code:", [this](const Json::Value &response) {
-                            SendQuery(
-                                td::td_api::make_object<td::td_api::checkAuthenticationCode>(response["text"].asString()),
-                                CreateAuthenticationQueryHandler()
-                            );
-                        });
+                    [this, &secrets, &suffix, &sendCode](td::td_api::authorizationStateWaitCode &) {
+                        BotProcessor->SendMessage(secrets["user_id"].asString(), "Reply with the authentication code" + suffix + ":", sendCode);
                     },
-                    [this](td::td_api::authorizationStateWaitRegistration &) {
-                        SendQuery(td::td_api::make_object<td::td_api::registerUser>("Sergey", ""), CreateAuthenticationQueryHandler());
+                    [this, account](td::td_api::authorizationStateWaitRegistration &) {
+                        SendQuery(account, td::td_api::make_object<td::td_api::registerUser>("Sergey", ""), CreateAuthenticationQueryHandler(account));
                     },
-                    [this](td::td_api::authorizationStateWaitPassword &) {
-                        SendQuery(td::td_api::make_object<td::td_api::checkAuthenticationPassword>(Secrets["password"].asString()), CreateAuthenticationQueryHandler());
+                    [this, account, &secrets](td::td_api::authorizationStateWaitPassword &) {
+                        SendQuery(account, td::td_api::make_object<td::td_api::checkAuthenticationPassword>(secrets["password"].asString()), CreateAuthenticationQueryHandler(account));
                     },
-                    [this](td::td_api::authorizationStateWaitOtherDeviceConfirmation &state) {
-                        BotProcessor->SendMessage(Secrets["user_id"].asString(), std::string("Confirm this login link on another device: ") + state.link_, [this](const Json::Value &) {
+                    [this, &secrets, &suffix](td::td_api::authorizationStateWaitOtherDeviceConfirmation &confirmation) {
+                        BotProcessor->SendMessage(secrets["user_id"].asString(), "Confirm this login link" + suffix + " on another device: " + confirmation.link_, [](const Json::Value &) {
                         });
                     },
-                    [this](td::td_api::authorizationStateWaitTdlibParameters &) {
+                    [this, account, &secrets](td::td_api::authorizationStateWaitTdlibParameters &) {
                         auto request = td::td_api::make_object<td::td_api::setTdlibParameters>();
-                        request->database_directory_ = Secrets["db"].asString();
+                        request->database_directory_ = secrets["db"].asString();
                         request->use_message_database_ = true;
                         request->use_secret_chats_ = false;
-                        request->api_id_ = Secrets["api_id"].asInt64();
-                        request->api_hash_ = Secrets["api_hash"].asString();
+                        request->api_id_ = secrets["api_id"].asInt64();
+                        request->api_hash_ = secrets["api_hash"].asString();
                         request->system_language_code_ = "en";
                         request->device_model_ = "Server";
                         request->application_version_ = "2.0";
                         request->enable_storage_optimizer_ = true;
-                        SendQuery(std::move(request), CreateAuthenticationQueryHandler());
+                        SendQuery(account, std::move(request), CreateAuthenticationQueryHandler(account));
                     }));
 }
 
-void TChatFetcher::CheckAuthenticationError(Object object) {
+void TChatFetcher::CheckAuthenticationError(std::size_t account, Object object) {
     if (object->get_id() == td::td_api::error::ID) {
         auto error = td::move_tl_object_as<td::td_api::error>(object);
         std::cerr << "Error: " << to_string(error) << std::flush;
-        OnAuthorisationStateUpdate();
+        OnAuthorisationStateUpdate(account);
     }
 }
 
@@ -366,3 +607,11 @@ std::uint64_t TChatFetcher::NextQueryId() {
     return ++CurrentQueryId;
 }
 
+void TChatFetcher::SaveChatCaches() {
+    for (std::size_t i = 0; i < Accounts.size(); ++i) {
+        std::string error;
+        if (!Accounts[i].Chats->Save(error))
+            std::cerr << "Failed to save chats of account " << i << ": " << error << std::endl;
+    }
+}
+
@@ -17,33 +17,78 @@
 #include <unordered_set>
 #include <vector>
 
+#include "chat_cache.h"
+#include "chat_export.h"
+#include "chat_lister.h"
 #include "helpers.h"
+#include "job_server.h"
 #include "json/json.h"
+#include "options.h"
 #include "requests.h"
 
 
+enum class EJobState {
+    Queued,
+    Running,
+    // Cancelled or failed, waiting for responses to its requests
+    Stopping,
+    Done,
+    Cancelled,
+    Failed
+};
+
 class TChatFetcher {
     public:
         ~TChatFetcher();
         static void Init(const Json::Value &secrets);
         static void Destroy();
         static std::shared_ptr<TChatFetcher> Instance();
-        void Main(long long chatId);
+        void Main(const TOptions &options);
         void SetExit();
 
     private:
         Json::Value Secrets;
         using Object = td::td_api::object_ptr<td::td_api::Object>;
         std::unique_ptr<td::ClientManager> ClientManager;
-        std::int32_t ClientId = 0;
-        td::td_api::object_ptr<td::td_api::AuthorizationState> AuthorisationState;
-        bool IsAuthorised = false;
+        // One TDLib client per account, all of them are served by the same receive loop
+        struct TAccount {
+            // Secrets of the account over the shared ones
+            Json::Value Secrets;
+            std::int32_t ClientId = 0;
+            td::td_api::object_ptr<td::td_api::AuthorizationState> AuthorisationState;
+            bool IsAuthorised = false;
+            bool IsClosed = false;
+            std::uint64_t AuthenticationQueryId = 0;
+            std::map<std::uint64_t, std::function<void(Object)>> Handlers;
+            // Jobs started on the account, the least used idle one takes the next job
+            std::size_t Jobs = 0;
+            // Job running on the account, 0 when it is idle
+            std::uint64_t JobId = 0;
+            // Chats known to the account, saved next to its TDLib database
+            std::unique_ptr<TChatCache> Chats;
+            // Loads all chat lists once the account is authorised
+            std::unique_ptr<TChatLister> Lister;
+        };
+        std::vector<TAccount> Accounts;
         std::atomic<bool> Exit;
         std::uint64_t CurrentQueryId = 0;
-        std::uint64_t AuthenticationQueryId = 0;
-        std::map<std::uint64_t, std::function<void(Object)>> Handlers;
         std::unique_ptr<TBotProcessor> BotProcessor;
-        std::map<std::int64_t, std::string> ChatTitles;
+        // Chat updates are logged to stderr
+        bool Verbose = false;
+        struct TJob {
+            TOptions Options;
+            EJobState State = EJobState::Queued;
+            std::string Error;
+            std::size_t Messages = 0;
+            std::size_t Account = 0;
+            // State of the export while it runs and until its requests are answered
+            std::unique_ptr<TChatExport> Export;
+        };
+        // A single export is the only job, a daemon takes them from the socket.
+        // Every authorised account runs one job at a time, jobs writing into the same place wait for each other.
+        std::map<std::uint64_t, TJob> Jobs;
+        std::uint64_t NextJobId = 1;
+        std::unique_ptr<TJobServer> JobServer;
 
         static std::shared_ptr<TChatFetcher> &InstancePrivate();
         TChatFetcher(const Json::Value &secrets);
@@ -52,16 +97,28 @@ class TChatFetcher {
         TChatFetcher(TChatFetcher &&) = delete;
         TChatFetcher &&operator = (TChatFetcher &&) = delete;
         bool IsExit() const;
-        void SendQuery(td::td_api::object_ptr<td::td_api::Function> f, std::function<void(Object)> handler);
+        void SendQuery(std::size_t account, td::td_api::object_ptr<td::td_api::Function> f, std::function<void(Object)> handler);
         void ProcessResponse(td::ClientManager::Response response);
-        void ProcessUpdate(td::td_api::object_ptr<td::td_api::Object> update);
-        auto CreateAuthenticationQueryHandler();
-        void OnAuthorisationStateUpdate();
-        void CheckAuthenticationError(Object object);
+        void ProcessUpdate(std::size_t account, td::td_api::object_ptr<td::td_api::Object> update);
+        bool IsAnyAuthorised() const;
+        auto CreateAuthenticationQueryHandler(std::size_t account);
+        void OnAuthorisationStateUpdate(std::size_t account);
+        void CheckAuthenticationError(std::size_t account, Object object);
         std::uint64_t NextQueryId();
+        void SaveChatCaches();
 
-        Json::Value ParseSender(td::td_api::MessageSender &sender);
-        Json::Value ParseContent(td::td_api::MessageContent &content);
-        Json::Value ParseMessage(td::td_api::message &message);
+        // Starts queued jobs on idle authorised accounts
+        void StartJobs();
+        void StartJob(std::uint64_t id, TJob &job, std::size_t account);
+        // True if a running job writes into some output of the options
+        bool IsOutputBusy(const TOptions &options) const;
+        bool HasActiveJobs() const;
+        bool HasQueuedJobs() const;
+        // Pumps running jobs and finishes the complete and the stopped ones
+        void PumpJobs();
+        // Finishes the outputs of the job and forgets its state
+        void FinishJob(std::uint64_t id, TJob &job, EJobState state);
+        Json::Value HandleJobRequest(const Json::Value &request);
+        Json::Value DescribeJob(std::uint64_t id, const TJob &job) const;
 };
 
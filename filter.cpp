@@ -0,0 +1,84 @@
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+#include <td/telegram/td_api.hpp>
+
+#include <string>
+
+#include "content.h"
+#include "filter.h"
+#include "helpers.h"
+#include "options.h"
+#include "serializer.h"
+
+
+bool CanSearch(const TMessageFilter &filter) {
+    // The search query matches words and their prefixes, so substrings of --contains are only checked locally
+    if (filter.SenderId != 0 || filter.ThreadId != 0)
+        return true;
+    return MakeSearchMessagesFilter(filter.ContentType)->get_id() != td::td_api::searchMessagesFilterEmpty::ID;
+}
+
+td::td_api::object_ptr<td::td_api::SearchMessagesFilter> MakeSearchMessagesFilter(const std::string &contentType) {
+    if (contentType == "photo")
+        return td::td_api::make_object<td::td_api::searchMessagesFilterPhoto>();
+    if (contentType == "video")
+        return td::td_api::make_object<td::td_api::searchMessagesFilterVideo>();
+    if (contentType == "document")
+        return td::td_api::make_object<td::td_api::searchMessagesFilterDocument>();
+    if (contentType == "audio")
+        return td::td_api::make_object<td::td_api::searchMessagesFilterAudio>();
+    if (contentType == "animation")
+        return td::td_api::make_object<td::td_api::searchMessagesFilterAnimation>();
+    if (contentType == "voice_note")
+        return td::td_api::make_object<td::td_api::searchMessagesFilterVoiceNote>();
+    if (contentType == "video_note")
+        return td::td_api::make_object<td::td_api::searchMessagesFilterVideoNote>();
+    if (contentType == "chat_change_photo")
+        return td::td_api::make_object<td::td_api::searchMessagesFilterChatPhoto>();
+    return td::td_api::make_object<td::td_api::searchMessagesFilterEmpty>();
+}
+
+td::td_api::object_ptr<td::td_api::MessageSender> MakeMessageSender(long long senderId) {
+    if (senderId == 0)
+        return nullptr;
+    if (senderId > 0)
+        return td::td_api::make_object<td::td_api::messageSenderUser>(senderId);
+    return td::td_api::make_object<td::td_api::messageSenderChat>(senderId);
+}
+
+long long GetSenderId(td::td_api::message &message) {
+    long long senderId = 0;
+    if (message.sender_id_)
+        td::td_api::downcast_call(
+            *message.sender_id_, overloaded(
+                [&senderId](td::td_api::messageSenderUser &user) {
+                    senderId = user.user_id_;
+                },
+                [&senderId](td::td_api::messageSenderChat &chat) {
+                    senderId = chat.chat_id_;
+                },
+                [](auto &) {
+                }
+            )
+        );
+    return senderId;
+}
+
+bool MatchesFilter(const TMessageFilter &filter, td::td_api::message &message) {
+    if (filter.MinDate != 0 && message.date_ < filter.MinDate)
+        return false;
+    if (filter.MaxDate != 0 && message.date_ >= filter.MaxDate)
+        return false;
+    if (filter.ThreadId != 0 && message.message_thread_id_ != filter.ThreadId)
+        return false;
+    if (filter.SenderId != 0 && GetSenderId(message) != filter.SenderId)
+        return false;
+    if (!filter.ContentType.empty() && (!message.content_ || GetContentType(*message.content_) != filter.ContentType))
+        return false;
+    if (!filter.Contains.empty()) {
+        const std::string *text = message.content_ ? GetContentText(*message.content_) : nullptr;
+        if (!text || text->find(filter.Contains) == std::string::npos)
+            return false;
+    }
+    return true;
+}
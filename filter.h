@@ -0,0 +1,19 @@
+#pragma once
+
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+
+#include <string>
+
+#include "options.h"
+
+
+// True if searchChatMessages can narrow the history down on the server side
+bool CanSearch(const TMessageFilter &filter);
+// Server side filter for the content type, searchMessagesFilterEmpty if TDLib has none
+td::td_api::object_ptr<td::td_api::SearchMessagesFilter> MakeSearchMessagesFilter(const std::string &contentType);
+td::td_api::object_ptr<td::td_api::MessageSender> MakeMessageSender(long long senderId);
+// User id of the sender or negative id of the sender chat, 0 if unknown
+long long GetSenderId(td::td_api::message &message);
+// Client side check of everything in the filter, search results are approximate and are checked as well
+bool MatchesFilter(const TMessageFilter &filter, td::td_api::message &message);
@@ -0,0 +1,129 @@
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+#include <td/telegram/td_api.hpp>
+
+#include <iostream>
+
+#include "filter.h"
+#include "helpers.h"
+#include "history.h"
+
+
+constexpr std::int32_t THistoryPager::PageSize;
+constexpr std::size_t THistoryPager::MaxErrors;
+
+THistoryPager::THistoryPager(long long chatId, const TMessageFilter &filter, long long threadId)
+    : ChatId(chatId)
+    , ThreadId(threadId)
+    , Filter(filter)
+    , UseSearch(CanSearch(filter))
+    , AnchorResolved(filter.MaxDate == 0)
+{
+}
+
+td::td_api::object_ptr<td::td_api::Function> THistoryPager::NextRequest() {
+    if (Done)
+        return nullptr;
+    ++Requests;
+    if (!AnchorResolved)
+        return td::td_api::make_object<td::td_api::getChatMessageByDate>(ChatId, Filter.MaxDate - 1);
+    if (UseSearch) {
+        auto request = td::td_api::make_object<td::td_api::searchChatMessages>();
+        request->chat_id_ = ChatId;
+        request->sender_id_ = MakeMessageSender(Filter.SenderId);
+        request->from_message_id_ = FromMessageId;
+        request->offset_ = Offset;
+        request->limit_ = PageSize;
+        request->filter_ = MakeSearchMessagesFilter(Filter.ContentType);
+        request->message_thread_id_ = ThreadId != 0 ? ThreadId : Filter.ThreadId;
+        return request;
+    }
+    if (ThreadId != 0)
+        return td::td_api::make_object<td::td_api::getMessageThreadHistory>(ChatId, ThreadId, FromMessageId, Offset, PageSize);
+    return td::td_api::make_object<td::td_api::getChatHistory>(ChatId, FromMessageId, Offset, PageSize, false);
+}
+
+THistoryPager::TMessages THistoryPager::OnResponse(Object object) {
+    TMessages result;
+    td::td_api::downcast_call(
+        *object, overloaded(
+            [this](td::td_api::message &message) {
+                // The last message sent before the upper date bound, the one newer message fetched with it is filtered out
+                AnchorResolved = true;
+                FromMessageId = message.id_;
+                Offset = -1;
+                Errors = 0;
+            },
+            [this, &result](td::td_api::messages &messages) {
+                Errors = 0;
+                OnPage(messages.messages_, result);
+            },
+            [this, &result](td::td_api::foundChatMessages &found) {
+                Errors = 0;
+                OnPage(found.messages_, result);
+                if (found.next_from_message_id_ == 0) {
+                    Done = true;
+                } else {
+                    FromMessageId = found.next_from_message_id_;
+                    Offset = 0;
+                }
+            },
+            [this](td::td_api::error &error) {
+                if (!AnchorResolved && error.code_ == 404) {
+                    // Nothing was sent before the upper date bound
+                    Done = true;
+                    return;
+                }
+                std::cerr << "History request for chat " << ChatId << " failed: " << error.code_ << ' ' << error.message_ << std::endl;
+                if (++Errors >= MaxErrors)
+                    Done = true;
+            },
+            [](auto &) {
+            }
+        )
+    );
+    return result;
+}
+
+bool THistoryPager::IsDone() const {
+    return Done;
+}
+
+std::size_t THistoryPager::GetRequestCount() const {
+    return Requests;
+}
+
+long long THistoryPager::GetLastMessageId() const {
+    return LastMessageId;
+}
+
+void THistoryPager::ResumeAfter(long long messageId) {
+    // The message itself is on the first page again and is skipped as already seen
+    AnchorResolved = true;
+    FromMessageId = LastMessageId = messageId;
+    Offset = 0;
+}
+
+void THistoryPager::OnPage(TMessages &page, TMessages &result) {
+    const long long previousMessageId = LastMessageId;
+    for (auto &message : page) {
+        if (!message)
+            continue;
+        // Neighbouring pages may share the boundary message
+        if (LastMessageId != 0 && message->id_ >= LastMessageId)
+            continue;
+        LastMessageId = message->id_;
+        if (Filter.MinDate != 0 && message->date_ < Filter.MinDate) {
+            Done = true;
+            break;
+        }
+        if (MatchesFilter(Filter, *message))
+            result.push_back(std::move(message));
+    }
+    if (LastMessageId == previousMessageId) {
+        Done = true;
+        return;
+    }
+    FromMessageId = LastMessageId;
+    Offset = 0;
+}
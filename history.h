@@ -0,0 +1,54 @@
+#pragma once
+
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "options.h"
+
+
+// Pages one chat from the newest message backwards.
+// Sender, thread, text and most content type filters are pushed down into searchChatMessages,
+// the upper date bound is turned into a starting message with getChatMessageByDate and paging stops
+// at the lower one, so only the requested part of the history is requested at all.
+// Forum topics and other message threads can be paged on their own.
+class THistoryPager {
+    public:
+        using Object = td::td_api::object_ptr<td::td_api::Object>;
+        using TMessages = std::vector<td::td_api::object_ptr<td::td_api::message>>;
+
+        // With a thread id only the message thread is paged, through getMessageThreadHistory
+        THistoryPager(long long chatId, const TMessageFilter &filter, long long threadId = 0);
+
+        // Request for the next page, nullptr once the history is exhausted
+        td::td_api::object_ptr<td::td_api::Function> NextRequest();
+        // Consumes the response to the last request and returns messages of the page which pass the filter
+        TMessages OnResponse(Object object);
+        bool IsDone() const;
+        std::size_t GetRequestCount() const;
+        // The oldest message handled so far, every newer one has been returned or filtered out
+        long long GetLastMessageId() const;
+        // Continues after a message handled by a previous run
+        void ResumeAfter(long long messageId);
+
+    private:
+        static constexpr std::int32_t PageSize = 100;
+        static constexpr std::size_t MaxErrors = 5;
+
+        long long ChatId;
+        long long ThreadId;
+        TMessageFilter Filter;
+        bool UseSearch;
+        bool AnchorResolved;
+        long long FromMessageId = 0;
+        std::int32_t Offset = 0;
+        long long LastMessageId = 0;
+        bool Done = false;
+        std::size_t Errors = 0;
+        std::size_t Requests = 0;
+
+        void OnPage(TMessages &page, TMessages &result);
+};
@@ -0,0 +1,134 @@
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <utility>
+
+#include "job_server.h"
+
+
+TJobServer::TJobServer(const std::string &path, THandler handler)
+    : Path(path)
+    , Handler(std::move(handler))
+{
+}
+
+TJobServer::~TJobServer() {
+    for (const auto &connection : Connections)
+        close(connection.Fd);
+    if (Fd >= 0) {
+        close(Fd);
+        unlink(Path.c_str());
+    }
+}
+
+bool TJobServer::Open(std::string &error) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (Path.size() >= sizeof(address.sun_path)) {
+        error = "Socket path " + Path + " is too long";
+        return false;
+    }
+    memcpy(address.sun_path, Path.c_str(), Path.size() + 1);
+    Fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (Fd < 0) {
+        error = std::string("Cannot create socket: ") + strerror(errno);
+        return false;
+    }
+    unlink(Path.c_str());
+    // Jobs write files with the rights of the daemon, so nobody else may submit them
+    const mode_t mask = umask(0077);
+    const bool bound = bind(Fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+    umask(mask);
+    if (!bound || listen(Fd, 16) != 0) {
+        error = "Cannot listen on " + Path + ": " + strerror(errno);
+        close(Fd);
+        Fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void TJobServer::Pump() {
+    while (true) {
+        const int fd = accept4(Fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            break;
+        TConnection connection;
+        connection.Fd = fd;
+        Connections.push_back(std::move(connection));
+    }
+    for (std::size_t i = 0; i < Connections.size();) {
+        if (Serve(Connections[i])) {
+            ++i;
+            continue;
+        }
+        close(Connections[i].Fd);
+        Connections[i] = std::move(Connections.back());
+        Connections.pop_back();
+    }
+}
+
+bool TJobServer::Serve(TConnection &connection) {
+    char buffer[4096];
+    while (!connection.Closing) {
+        const ssize_t size = read(connection.Fd, buffer, sizeof(buffer));
+        if (size > 0) {
+            connection.Input.append(buffer, static_cast<std::size_t>(size));
+            continue;
+        }
+        if (size < 0 && errno == EINTR)
+            continue;
+        // The peer has closed its side, answers to complete requests are still sent
+        if (size == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+            connection.Closing = true;
+        break;
+    }
+    std::size_t begin = 0;
+    for (std::size_t end; (end = connection.Input.find('\n', begin)) != std::string::npos; begin = end + 1)
+        connection.Output += Answer(connection.Input.substr(begin, end - begin));
+    connection.Input.erase(0, begin);
+    if (connection.Input.size() > MaxRequestSize)
+        return false;
+    while (!connection.Output.empty()) {
+        const ssize_t size = send(connection.Fd, connection.Output.data(), connection.Output.size(), MSG_NOSIGNAL);
+        if (size < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+        connection.Output.erase(0, static_cast<std::size_t>(size));
+    }
+    return !connection.Closing || !connection.Output.empty();
+}
+
+std::string TJobServer::Answer(const std::string &line) {
+    Json::Value request;
+    Json::Value response;
+    Json::Reader reader;
+    if (!reader.parse(line, request) || !request.isObject()) {
+        response["ok"] = false;
+        response["error"] = "Request must be a JSON object";
+    } else {
+        // Fields of unexpected types throw
+        try {
+            response = Handler(request);
+        } catch (const std::exception &ex) {
+            response = Json::Value();
+            response["ok"] = false;
+            response["error"] = ex.what();
+        }
+    }
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    return Json::writeString(builder, response) + "\n";
+}
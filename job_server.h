@@ -0,0 +1,48 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "json/json.h"
+
+
+// Local control socket of the daemon. Clients send one JSON object per line and get one JSON object
+// per line back, in order; a connection may carry any number of requests. Everything is non-blocking
+// and served from Pump, so requests are handled on the fetch loop between TDLib responses.
+class TJobServer {
+    public:
+        using THandler = std::function<Json::Value(const Json::Value &request)>;
+
+        TJobServer(const std::string &path, THandler handler);
+        ~TJobServer();
+
+        // Replaces a stale socket file, the socket is accessible to the owner only
+        bool Open(std::string &error);
+        // Accepts connections and answers complete requests without waiting
+        void Pump();
+
+    private:
+        static constexpr std::size_t MaxRequestSize = 1 << 20;
+
+        struct TConnection {
+            int Fd = -1;
+            std::string Input;
+            std::string Output;
+            bool Closing = false;
+        };
+
+        std::string Path;
+        THandler Handler;
+        int Fd = -1;
+        std::vector<TConnection> Connections;
+
+        TJobServer(const TJobServer &) = delete;
+        TJobServer &operator = (const TJobServer &) = delete;
+        TJobServer(TJobServer &&) = delete;
+        TJobServer &&operator = (TJobServer &&) = delete;
+
+        // Returns false once the connection is to be dropped
+        bool Serve(TConnection &connection);
+        std::string Answer(const std::string &line);
+};
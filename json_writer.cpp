@@ -0,0 +1,280 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "json_writer.h"
+#include "utf8.h"
+#include "utf8_simd.h"
+
+
+namespace {
+    // Clean runs at least this long are referenced in place instead of being copied
+    const std::size_t MinSpliceSize = 512;
+
+    // Receives clean runs and bytes to escape of one string
+    struct TEscapeOutput {
+        std::string &Output;
+        std::vector<TOutputSplice> *Splices;
+
+        void Run(const char *data, std::size_t size) {
+            if (Splices && size >= MinSpliceSize)
+                Splices->push_back({Output.size(), data, size});
+            else
+                Output.append(data, size);
+        }
+
+        void Escape(unsigned char c) {
+            static const char hex[] = "0123456789abcdef";
+            switch (c) {
+                case '"': Output += "\\\""; break;
+                case '\\': Output += "\\\\"; break;
+                case '\b': Output += "\\b"; break;
+                case '\f': Output += "\\f"; break;
+                case '\n': Output += "\\n"; break;
+                case '\r': Output += "\\r"; break;
+                case '\t': Output += "\\t"; break;
+                default:
+                    Output += "\\u00";
+                    Output += hex[c >> 4];
+                    Output += hex[c & 0xF];
+            }
+        }
+    };
+
+    // Escapes the string and returns whether it is valid UTF-8
+    using TEscapeFunction = bool (*)(const char *data, std::size_t size, TEscapeOutput &output);
+
+    bool EscapeScalar(const char *data, std::size_t size, TEscapeOutput &output) {
+        std::size_t begin = 0;
+        for (std::size_t i = 0; i < size; ++i) {
+            const unsigned char c = static_cast<unsigned char>(data[i]);
+            if (c >= 0x20 && c != '"' && c != '\\')
+                continue;
+            output.Run(data + begin, i - begin);
+            output.Escape(c);
+            begin = i + 1;
+        }
+        output.Run(data + begin, size - begin);
+        return IsValidUtf8Scalar(data, size);
+    }
+
+#if defined(__SSE2__)
+    using namespace detail;
+
+    // Every block is loaded once: it is validated as UTF-8 and searched for quotes, backslashes and
+    // control characters, which are the bytes left unchanged by an unsigned maximum with 0x1F.
+    // The tail is padded with spaces, which are neither special nor able to complete a sequence.
+    __attribute__((target("ssse3"))) bool EscapeSsse3(const char *data, std::size_t size, TEscapeOutput &output) {
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i control = _mm_set1_epi8(0x1F);
+        __m128i previous = _mm_setzero_si128();
+        __m128i previousIncomplete = _mm_setzero_si128();
+        __m128i error = _mm_setzero_si128();
+        alignas(16) char tail[16];
+        std::size_t begin = 0;
+        for (std::size_t i = 0; i < size; i += 16) {
+            __m128i chunk;
+            if (i + 16 <= size) {
+                chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            } else {
+                memset(tail, ' ', sizeof(tail));
+                memcpy(tail, data + i, size - i);
+                chunk = _mm_load_si128(reinterpret_cast<const __m128i *>(tail));
+            }
+            CheckBlockSsse3(chunk, previous, previousIncomplete, error);
+            const __m128i special = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(chunk, quote), _mm_cmpeq_epi8(chunk, backslash)),
+                _mm_cmpeq_epi8(_mm_max_epu8(chunk, control), control)
+            );
+            for (unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(special)); mask != 0; mask &= mask - 1) {
+                const std::size_t j = i + __builtin_ctz(mask);
+                output.Run(data + begin, j - begin);
+                output.Escape(static_cast<unsigned char>(data[j]));
+                begin = j + 1;
+            }
+        }
+        output.Run(data + begin, size - begin);
+        error = _mm_or_si128(error, previousIncomplete);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+    }
+
+    __attribute__((target("avx2"))) bool EscapeAvx2(const char *data, std::size_t size, TEscapeOutput &output) {
+        const __m256i quote = _mm256_set1_epi8('"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i control = _mm256_set1_epi8(0x1F);
+        __m256i previous = _mm256_setzero_si256();
+        __m256i previousIncomplete = _mm256_setzero_si256();
+        __m256i error = _mm256_setzero_si256();
+        alignas(32) char tail[32];
+        std::size_t begin = 0;
+        for (std::size_t i = 0; i < size; i += 32) {
+            __m256i chunk;
+            if (i + 32 <= size) {
+                chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+            } else {
+                memset(tail, ' ', sizeof(tail));
+                memcpy(tail, data + i, size - i);
+                chunk = _mm256_load_si256(reinterpret_cast<const __m256i *>(tail));
+            }
+            CheckBlockAvx2(chunk, previous, previousIncomplete, error);
+            const __m256i special = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(chunk, quote), _mm256_cmpeq_epi8(chunk, backslash)),
+                _mm256_cmpeq_epi8(_mm256_max_epu8(chunk, control), control)
+            );
+            for (unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(special)); mask != 0; mask &= mask - 1) {
+                const std::size_t j = i + __builtin_ctz(mask);
+                output.Run(data + begin, j - begin);
+                output.Escape(static_cast<unsigned char>(data[j]));
+                begin = j + 1;
+            }
+        }
+        output.Run(data + begin, size - begin);
+        error = _mm256_or_si256(error, previousIncomplete);
+        return _mm256_testz_si256(error, error) != 0;
+    }
+#endif
+
+    TEscapeFunction SelectEscape() {
+#if defined(__SSE2__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return EscapeAvx2;
+        if (__builtin_cpu_supports("ssse3"))
+            return EscapeSsse3;
+#endif
+        return EscapeScalar;
+    }
+
+    bool EscapeString(const char *data, std::size_t size, std::string &output, std::vector<TOutputSplice> *splices) {
+        static const TEscapeFunction escape = SelectEscape();
+        TEscapeOutput escapeOutput{output, splices};
+        return escape(data, size, escapeOutput);
+    }
+}
+
+
+void EscapeJsonString(const char *data, std::size_t size, std::string &output) {
+    EscapeString(data, size, output, nullptr);
+}
+
+
+TJsonWriter::TJsonWriter(std::string &output, bool repairUtf8, std::vector<TOutputSplice> *splices)
+    : Output(output)
+    , RepairUtf8Strings(repairUtf8)
+    , Splices(splices)
+{
+}
+
+void TJsonWriter::BeginObject() {
+    BeforeValue();
+    Output += '{';
+    ++Depth;
+    HasValue &= ~(1ULL << (Depth & 63));
+}
+
+void TJsonWriter::EndObject() {
+    --Depth;
+    Output += '}';
+}
+
+void TJsonWriter::BeginArray() {
+    BeforeValue();
+    Output += '[';
+    ++Depth;
+    HasValue &= ~(1ULL << (Depth & 63));
+}
+
+void TJsonWriter::EndArray() {
+    --Depth;
+    Output += ']';
+}
+
+void TJsonWriter::Key(const char *key) {
+    BeforeValue();
+    Output += '"';
+    Output += key;
+    Output += "\":";
+    AfterKey = true;
+}
+
+void TJsonWriter::Null() {
+    BeforeValue();
+    Output += "null";
+}
+
+void TJsonWriter::Bool(bool value) {
+    BeforeValue();
+    Output += value ? "true" : "false";
+}
+
+void TJsonWriter::Int(std::int64_t value) {
+    BeforeValue();
+    char buffer[24];
+    char *end = buffer + sizeof(buffer);
+    char *begin = end;
+    std::uint64_t magnitude = value < 0 ? 0 - static_cast<std::uint64_t>(value) : static_cast<std::uint64_t>(value);
+    do {
+        *--begin = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0)
+        *--begin = '-';
+    Output.append(begin, end - begin);
+}
+
+void TJsonWriter::Double(double value) {
+    BeforeValue();
+    if (!std::isfinite(value)) {
+        Output += "null";
+        return;
+    }
+    char buffer[32];
+    int size = snprintf(buffer, sizeof(buffer), "%.17g", value);
+    Output.append(buffer, size);
+}
+
+void TJsonWriter::String(const char *value) {
+    String(value, strlen(value));
+}
+
+void TJsonWriter::String(const std::string &value) {
+    String(value.data(), value.size());
+}
+
+void TJsonWriter::String(const char *data, std::size_t size) {
+    BeforeValue();
+    Output += '"';
+    const std::size_t offset = Output.size();
+    const std::size_t splices = Splices ? Splices->size() : 0;
+    if (!EscapeString(data, size, Output, Splices)) {
+        ValidUtf8 = false;
+        // Invalid strings are rare, so the repair redoes the string instead of slowing down the common path
+        if (RepairUtf8Strings) {
+            Output.resize(offset);
+            if (Splices)
+                Splices->resize(splices);
+            std::string repaired;
+            RepairUtf8(data, size, repaired);
+            EscapeString(repaired.data(), repaired.size(), Output, nullptr);
+        }
+    }
+    Output += '"';
+}
+
+bool TJsonWriter::IsValidUtf8() const {
+    return ValidUtf8;
+}
+
+void TJsonWriter::BeforeValue() {
+    if (AfterKey) {
+        AfterKey = false;
+        return;
+    }
+    std::uint64_t bit = 1ULL << (Depth & 63);
+    if (HasValue & bit)
+        Output += ',';
+    HasValue |= bit;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+// Appends JSON-escaped contents of the string to output without the surrounding quotes.
+// Scans 32 (AVX2) or 16 (SSSE3) bytes at a time, bytes outside of ASCII are copied as is.
+void EscapeJsonString(const char *data, std::size_t size, std::string &output);
+
+// Bytes referenced in place, to be inserted into the output at the offset
+struct TOutputSplice {
+    std::size_t Offset;
+    const char *Data;
+    std::size_t Size;
+};
+
+
+// Streams compact JSON into a string without building a document first.
+// Keys are expected to be ASCII literals which need no escaping.
+// Strings are validated as UTF-8 while they are escaped, in the repair mode invalid sequences are replaced with U+FFFD.
+// With splices long clean runs of strings are not copied but referenced, so the strings must outlive the output.
+class TJsonWriter {
+    public:
+        explicit TJsonWriter(std::string &output, bool repairUtf8 = false, std::vector<TOutputSplice> *splices = nullptr);
+
+        void BeginObject();
+        void EndObject();
+        void BeginArray();
+        void EndArray();
+        void Key(const char *key);
+        void Null();
+        void Bool(bool value);
+        void Int(std::int64_t value);
+        void Double(double value);
+        void String(const char *value);
+        void String(const std::string &value);
+        void String(const char *data, std::size_t size);
+        // False once any written string was not valid UTF-8
+        bool IsValidUtf8() const;
+
+    private:
+        std::string &Output;
+        bool RepairUtf8Strings;
+        std::vector<TOutputSplice> *Splices;
+        // Bit per nesting level, set once the level has a value and the next one needs a comma
+        std::uint64_t HasValue = 0;
+        unsigned Depth = 0;
+        bool AfterKey = false;
+        bool ValidUtf8 = true;
+
+        void BeforeValue();
+};
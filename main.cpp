@@ -4,13 +4,18 @@
 
 #include "json/json.h"
 #include "fetcher.h"
+#include "options.h"
+#include "reply_index.h"
+#include "ring_buffer.h"
+#include "segment_store.h"
+#include "text_index.h"
 
 
 void SignalHandler(int signal) {
     if (signal == SIGINT)
-        std::cout << "Ctrl+C received, exiting." << std::endl;
+        std::cerr << "Ctrl+C received, exiting." << std::endl;
     else
-        std::cout << "Signal received, exiting." << std::endl;
+        std::cerr << "Signal received, exiting." << std::endl;
     auto fetcher = TChatFetcher::Instance();
     if (fetcher)
         fetcher->SetExit();
@@ -26,16 +31,31 @@ Json::Value ReadSecrets() {
 }
 
 
-int main() {
+int main(int argc, char **argv) {
+    if (argc > 1 && std::string(argv[1]) == "replies")
+        return RunReplyQuery(argc - 1, argv + 1);
+    if (argc > 1 && std::string(argv[1]) == "search")
+        return RunTextSearch(argc - 1, argv + 1);
+    if (argc > 1 && std::string(argv[1]) == "ring")
+        return RunRingDump(argc - 1, argv + 1);
+    if (argc > 1 && std::string(argv[1]) == "seek")
+        return RunSegmentSeek(argc - 1, argv + 1);
+    TOptions options;
+    try {
+        options = ParseOptions(argc, argv);
+    } catch (const std::exception &ex) {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
     signal(SIGINT, SignalHandler);
     curl_global_init(CURL_GLOBAL_DEFAULT);
     TChatFetcher::Init(ReadSecrets());
     try {
-        TChatFetcher::Instance()->Main();
+        TChatFetcher::Instance()->Main(options);
     } catch (const std::exception &ex) {
-        std::cout << "Unhandled exception in main: " << ex.what() << std::endl;
+        std::cerr << "Unhandled exception in main: " << ex.what() << std::endl;
     } catch (...) {
-        std::cout << "Unhandled exception in main" << std::endl;
+        std::cerr << "Unhandled exception in main" << std::endl;
     }
     TChatFetcher::Destroy();
     curl_global_cleanup();
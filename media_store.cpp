@@ -0,0 +1,255 @@
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
+#include "json/json.h"
+
+#include "media_store.h"
+
+
+namespace {
+    bool CopyFile(const std::string &from, const std::string &to) {
+        std::ifstream fin(from, std::ios::binary);
+        std::ofstream fout(to, std::ios::binary | std::ios::trunc);
+        if (!fin || !fout)
+            return false;
+        fout << fin.rdbuf();
+        return static_cast<bool>(fout.flush());
+    }
+
+    // SHA-256 as specified in FIPS 180-4
+    class TSha256 {
+        public:
+            void Update(const unsigned char *data, std::size_t size) {
+                Length += size;
+                while (size > 0) {
+                    const std::size_t chunk = std::min(size, sizeof(Block) - BlockSize);
+                    memcpy(Block + BlockSize, data, chunk);
+                    BlockSize += chunk;
+                    data += chunk;
+                    size -= chunk;
+                    if (BlockSize == sizeof(Block)) {
+                        Transform();
+                        BlockSize = 0;
+                    }
+                }
+            }
+
+            std::string Final() {
+                const std::uint64_t bits = Length * 8;
+                const unsigned char one = 0x80;
+                const unsigned char zero = 0;
+                Update(&one, 1);
+                while (BlockSize != 56)
+                    Update(&zero, 1);
+                unsigned char length[8];
+                for (int i = 0; i < 8; ++i)
+                    length[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+                Update(length, sizeof(length));
+                std::stringstream ss;
+                for (std::uint32_t value : State)
+                    ss << std::hex << std::setw(8) << std::setfill('0') << value;
+                return ss.str();
+            }
+
+        private:
+            std::uint32_t State[8] = {
+                0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+            };
+            unsigned char Block[64];
+            std::size_t BlockSize = 0;
+            std::uint64_t Length = 0;
+
+            static std::uint32_t Rotate(std::uint32_t value, int bits) {
+                return (value >> bits) | (value << (32 - bits));
+            }
+
+            void Transform() {
+                static const std::uint32_t k[64] = {
+                    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+                };
+                std::uint32_t w[64];
+                for (int i = 0; i < 16; ++i)
+                    w[i] = static_cast<std::uint32_t>(Block[4 * i]) << 24 | static_cast<std::uint32_t>(Block[4 * i + 1]) << 16
+                        | static_cast<std::uint32_t>(Block[4 * i + 2]) << 8 | Block[4 * i + 3];
+                for (int i = 16; i < 64; ++i) {
+                    const std::uint32_t s0 = Rotate(w[i - 15], 7) ^ Rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                    const std::uint32_t s1 = Rotate(w[i - 2], 17) ^ Rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+                }
+                std::uint32_t a = State[0], b = State[1], c = State[2], d = State[3];
+                std::uint32_t e = State[4], f = State[5], g = State[6], h = State[7];
+                for (int i = 0; i < 64; ++i) {
+                    const std::uint32_t t1 = h + (Rotate(e, 6) ^ Rotate(e, 11) ^ Rotate(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+                    const std::uint32_t t2 = (Rotate(a, 2) ^ Rotate(a, 13) ^ Rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                    h = g;
+                    g = f;
+                    f = e;
+                    e = d + t1;
+                    d = c;
+                    c = b;
+                    b = a;
+                    a = t1 + t2;
+                }
+                State[0] += a;
+                State[1] += b;
+                State[2] += c;
+                State[3] += d;
+                State[4] += e;
+                State[5] += f;
+                State[6] += g;
+                State[7] += h;
+            }
+    };
+
+    bool MoveFile(const std::string &from, const std::string &to) {
+        if (rename(from.c_str(), to.c_str()) == 0)
+            return true;
+        if (errno != EXDEV || !CopyFile(from, to))
+            return false;
+        unlink(from.c_str());
+        return true;
+    }
+}
+
+
+bool MakeDirectories(const std::string &path) {
+    std::string current;
+    std::stringstream ss(path);
+    std::string part;
+    if (!path.empty() && path[0] == '/')
+        current = "/";
+    while (std::getline(ss, part, '/')) {
+        if (part.empty())
+            continue;
+        current += part;
+        if (mkdir(current.c_str(), 0755) != 0 && errno != EEXIST)
+            return false;
+        current += '/';
+    }
+    return true;
+}
+
+bool HashFile(const std::string &path, std::string &hash, std::int64_t &size) {
+    // Files are deduplicated by name, so the hash has to resist deliberate collisions
+    std::ifstream fin(path, std::ios::binary);
+    if (!fin)
+        return false;
+    TSha256 sha;
+    size = 0;
+    char buffer[1 << 16];
+    while (fin) {
+        fin.read(buffer, sizeof(buffer));
+        std::streamsize n = fin.gcount();
+        sha.Update(reinterpret_cast<const unsigned char *>(buffer), static_cast<std::size_t>(n));
+        size += n;
+    }
+    hash = sha.Final();
+    return true;
+}
+
+
+TMediaStore::TMediaStore(const std::string &root)
+    : Root(root)
+{
+    MakeDirectories(Root + "/by-id");
+    MakeDirectories(Root + "/objects");
+    LoadIndex();
+    Index.open(Root + "/index.jsonl", std::ios::app);
+}
+
+bool TMediaStore::Contains(const std::string &uniqueId) const {
+    return Entries.count(uniqueId) != 0;
+}
+
+const TMediaStore::TEntry *TMediaStore::Find(const std::string &uniqueId) const {
+    auto it = Entries.find(uniqueId);
+    return it == Entries.end() ? nullptr : &it->second;
+}
+
+bool TMediaStore::Add(const std::string &uniqueId, const std::string &sourcePath, std::string &error) {
+    if (Contains(uniqueId)) {
+        unlink(sourcePath.c_str());
+        return true;
+    }
+    TEntry entry;
+    if (!HashFile(sourcePath, entry.Hash, entry.Size)) {
+        error = "Cannot read " + sourcePath;
+        return false;
+    }
+    const std::string objectName = entry.Hash + "-" + std::to_string(entry.Size);
+    auto objectIt = Objects.find(objectName);
+    if (objectIt != Objects.end()) {
+        entry.Path = objectIt->second;
+        unlink(sourcePath.c_str());
+    } else {
+        const std::string directory = Root + "/objects/" + entry.Hash.substr(0, 2);
+        entry.Path = directory + "/" + objectName;
+        if (!MakeDirectories(directory) || !MoveFile(sourcePath, entry.Path)) {
+            error = "Cannot move " + sourcePath + " to " + entry.Path + ": " + strerror(errno);
+            return false;
+        }
+        Objects[objectName] = entry.Path;
+    }
+    const std::string idPath = GetIdPath(uniqueId);
+    unlink(idPath.c_str());
+    if (link(entry.Path.c_str(), idPath.c_str()) != 0 && !CopyFile(entry.Path, idPath)) {
+        error = "Cannot link " + idPath + ": " + strerror(errno);
+        return false;
+    }
+    AppendIndex(uniqueId, entry);
+    Entries[uniqueId] = std::move(entry);
+    return true;
+}
+
+std::string TMediaStore::GetIdPath(const std::string &uniqueId) const {
+    return Root + "/by-id/" + uniqueId;
+}
+
+void TMediaStore::LoadIndex() {
+    std::ifstream fin(Root + "/index.jsonl");
+    std::string line;
+    Json::Reader reader;
+    while (std::getline(fin, line)) {
+        Json::Value item;
+        // A torn last line after a crash is simply skipped
+        if (!reader.parse(line, item) || !item.isObject())
+            continue;
+        TEntry entry;
+        entry.Hash = item["hash"].asString();
+        entry.Size = item["size"].asInt64();
+        entry.Path = item["path"].asString();
+        struct stat st;
+        if (stat(entry.Path.c_str(), &st) != 0)
+            continue;
+        Objects[entry.Hash + "-" + std::to_string(entry.Size)] = entry.Path;
+        Entries[item["unique_id"].asString()] = std::move(entry);
+    }
+}
+
+void TMediaStore::AppendIndex(const std::string &uniqueId, const TEntry &entry) {
+    Json::Value item;
+    item["unique_id"] = uniqueId;
+    item["hash"] = entry.Hash;
+    item["size"] = static_cast<Json::Int64>(entry.Size);
+    item["path"] = entry.Path;
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    Index << Json::writeString(builder, item) << std::endl;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
+
+// Content-addressed storage for downloaded media.
+// Every blob lives once under objects/<hash prefix>/<sha256>-<size>, and by-id/<unique id>
+// is a hard link to it, so the same file forwarded into many chats takes space once.
+// The append-only index.jsonl survives restarts and lets known files skip the download.
+class TMediaStore {
+    public:
+        struct TEntry {
+            std::string Hash;
+            std::int64_t Size = 0;
+            std::string Path;
+        };
+
+        explicit TMediaStore(const std::string &root);
+
+        bool Contains(const std::string &uniqueId) const;
+        const TEntry *Find(const std::string &uniqueId) const;
+        // Moves a downloaded file into the store, returns false and fills error on failure
+        bool Add(const std::string &uniqueId, const std::string &sourcePath, std::string &error);
+        std::string GetIdPath(const std::string &uniqueId) const;
+
+    private:
+        std::string Root;
+        std::unordered_map<std::string, TEntry> Entries;
+        std::unordered_map<std::string, std::string> Objects;
+        std::ofstream Index;
+
+        TMediaStore(const TMediaStore &) = delete;
+        TMediaStore &operator = (const TMediaStore &) = delete;
+        TMediaStore(TMediaStore &&) = delete;
+        TMediaStore &&operator = (TMediaStore &&) = delete;
+
+        void LoadIndex();
+        void AppendIndex(const std::string &uniqueId, const TEntry &entry);
+};
+
+bool MakeDirectories(const std::string &path);
+bool HashFile(const std::string &path, std::string &hash, std::int64_t &size);
@@ -0,0 +1,179 @@
+#include <cctype>
+#include <cstdio>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "options.h"
+
+
+namespace {
+    EExportProfile ParseProfile(const std::string &name) {
+        if (name == "ids")
+            return EExportProfile::Ids;
+        if (name == "text")
+            return EExportProfile::Text;
+        if (name == "media")
+            return EExportProfile::Media;
+        if (name == "full")
+            return EExportProfile::Full;
+        throw std::invalid_argument("Unknown profile " + name + ", expected ids, text, media or full");
+    }
+
+    EPartitionKey ParsePartitionKey(const std::string &name) {
+        if (name == "month")
+            return EPartitionKey::Month;
+        if (name == "day")
+            return EPartitionKey::Day;
+        if (name == "sender")
+            return EPartitionKey::Sender;
+        if (name == "thread")
+            return EPartitionKey::Thread;
+        throw std::invalid_argument("Unknown partition key " + name + ", expected month, day, sender or thread");
+    }
+
+    // Unix timestamp or YYYY-MM-DD in UTC
+    std::int32_t ParseDate(const std::string &value) {
+        int year = 0, month = 0, day = 0;
+        char tail = 0;
+        if (sscanf(value.c_str(), "%d-%d-%d%c", &year, &month, &day, &tail) != 3)
+            return static_cast<std::int32_t>(std::stol(value));
+        struct tm tm = {};
+        tm.tm_year = year - 1900;
+        tm.tm_mon = month - 1;
+        tm.tm_mday = day;
+        return static_cast<std::int32_t>(timegm(&tm));
+    }
+
+    const char *NextArgument(int argc, char **argv, int &i) {
+        if (i + 1 >= argc)
+            throw std::invalid_argument(std::string("Missing value for ") + argv[i]);
+        return argv[++i];
+    }
+}
+
+
+TOptions ParseOptions(int argc, char **argv) {
+    TOptions options;
+    bool hasChatId = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--profile") {
+            options.Profile = ParseProfile(NextArgument(argc, argv, i));
+        } else if (arg == "--from-date") {
+            options.Filter.MinDate = ParseDate(NextArgument(argc, argv, i));
+        } else if (arg == "--to-date") {
+            options.Filter.MaxDate = ParseDate(NextArgument(argc, argv, i));
+        } else if (arg == "--sender") {
+            options.Filter.SenderId = std::stoll(NextArgument(argc, argv, i));
+        } else if (arg == "--content") {
+            options.Filter.ContentType = NextArgument(argc, argv, i);
+        } else if (arg == "--thread") {
+            options.Filter.ThreadId = std::stoll(NextArgument(argc, argv, i));
+        } else if (arg == "--contains") {
+            options.Filter.Contains = NextArgument(argc, argv, i);
+        } else if (arg == "--shards") {
+            options.Shards = std::stoul(NextArgument(argc, argv, i));
+            if (options.Shards == 0)
+                throw std::invalid_argument("--shards must be positive");
+        } else if (arg == "--threads") {
+            options.Threads = true;
+        } else if (arg == "--parallel") {
+            options.MaxParallelTasks = std::stoul(NextArgument(argc, argv, i));
+            if (options.MaxParallelTasks == 0)
+                throw std::invalid_argument("--parallel must be positive");
+        } else if (arg == "--shard-dir") {
+            options.ShardDirectory = NextArgument(argc, argv, i);
+        } else if (arg == "--download-media") {
+            options.DownloadMedia = true;
+        } else if (arg == "--max-downloads") {
+            options.MaxActiveDownloads = std::stoul(NextArgument(argc, argv, i));
+            if (options.MaxActiveDownloads == 0)
+                throw std::invalid_argument("--max-downloads must be positive");
+        } else if (arg == "--media-dir") {
+            options.MediaDirectory = NextArgument(argc, argv, i);
+        } else if (arg == "--repair-utf8") {
+            options.RepairUtf8 = true;
+        } else if (arg == "--reply-index") {
+            options.ReplyIndexDirectory = NextArgument(argc, argv, i);
+        } else if (arg == "--text-index") {
+            options.TextIndexDirectory = NextArgument(argc, argv, i);
+        } else if (arg == "--segment-dir") {
+            options.SegmentDirectory = NextArgument(argc, argv, i);
+        } else if (arg == "--segment-size") {
+            options.SegmentSize = std::stoul(NextArgument(argc, argv, i)) << 20;
+            if (options.SegmentSize == 0)
+                throw std::invalid_argument("--segment-size must be positive");
+        } else if (arg == "--segment-messages") {
+            options.SegmentMessages = std::stoul(NextArgument(argc, argv, i));
+        } else if (arg == "--async-output") {
+            options.AsyncOutput = true;
+        } else if (arg == "--ring") {
+            options.RingPath = NextArgument(argc, argv, i);
+        } else if (arg == "--ring-size") {
+            options.RingSize = std::stoul(NextArgument(argc, argv, i)) << 20;
+            if (options.RingSize == 0)
+                throw std::invalid_argument("--ring-size must be positive");
+        } else if (arg == "--output") {
+            options.OutputPath = NextArgument(argc, argv, i);
+        } else if (arg == "--commit-ms") {
+            options.CommitInterval = std::stoll(NextArgument(argc, argv, i));
+            if (options.CommitInterval < 0)
+                throw std::invalid_argument("--commit-ms must not be negative");
+        } else if (arg == "--partition-dir") {
+            options.PartitionDirectory = NextArgument(argc, argv, i);
+        } else if (arg == "--partition-by") {
+            options.PartitionKey = ParsePartitionKey(NextArgument(argc, argv, i));
+        } else if (arg == "--partition-buckets") {
+            options.PartitionBuckets = std::stoul(NextArgument(argc, argv, i));
+            if (options.PartitionBuckets == 0)
+                throw std::invalid_argument("--partition-buckets must be positive");
+        } else if (arg == "--max-open-files") {
+            options.MaxOpenPartitions = std::stoul(NextArgument(argc, argv, i));
+            if (options.MaxOpenPartitions == 0)
+                throw std::invalid_argument("--max-open-files must be positive");
+        } else if (arg == "--sqlite") {
+            options.SqlitePath = NextArgument(argc, argv, i);
+        } else if (arg == "--follow") {
+            options.Follow = true;
+        } else if (arg == "--account") {
+            options.Account = std::stoi(NextArgument(argc, argv, i));
+        } else if (arg == "--chat-manifest") {
+            options.ChatManifestPath = NextArgument(argc, argv, i);
+        } else if (arg == "--verbose") {
+            options.Verbose = true;
+        } else if (arg == "--daemon") {
+            options.DaemonSocket = NextArgument(argc, argv, i);
+        } else if (!arg.empty() && arg[0] == '-' && arg != "-" && !std::isdigit(static_cast<unsigned char>(arg[1]))) {
+            throw std::invalid_argument("Unknown option " + arg);
+        } else {
+            options.ChatId = std::stoll(arg);
+            hasChatId = true;
+        }
+    }
+    if (!hasChatId && options.DaemonSocket.empty())
+        throw std::invalid_argument("Usage: fetcher [--profile ids|text|media|full] [--from-date DATE] [--to-date DATE] [--sender ID] [--content TYPE] "
+                                    "[--thread ID] [--contains TEXT] [--shards K] [--threads] [--parallel N] [--shard-dir DIR] [--download-media] [--max-downloads N] [--media-dir DIR] [--repair-utf8] [--reply-index DIR] [--text-index DIR] [--segment-dir DIR] [--segment-size MB] [--segment-messages N] [--async-output] [--ring PATH] [--ring-size MB] [--output PATH] [--commit-ms N] [--partition-dir DIR] [--partition-by month|day|sender|thread] [--partition-buckets N] [--max-open-files N] [--sqlite PATH] [--follow] [--account N] [--verbose] [--chat-manifest PATH] <chat_id>\n"
+                                    "       fetcher --daemon SOCKET [--verbose] [--chat-manifest PATH]");
+    // Pages go to exactly one sink, a second one would get nothing and the checkpoint of --output would lie
+    std::vector<std::string> sinks;
+    if (!options.ShardDirectory.empty())
+        sinks.push_back("--shard-dir");
+    if (!options.SegmentDirectory.empty())
+        sinks.push_back("--segment-dir");
+    if (!options.PartitionDirectory.empty())
+        sinks.push_back("--partition-dir");
+    if (!options.SqlitePath.empty())
+        sinks.push_back("--sqlite");
+    if (!options.OutputPath.empty())
+        sinks.push_back("--output");
+    if (!options.RingPath.empty())
+        sinks.push_back("--ring");
+    if (sinks.size() > 1)
+        throw std::invalid_argument(sinks[0] + " cannot be combined with " + sinks[1] + ", messages are written to one of --shard-dir, --segment-dir, --partition-dir, --sqlite, --output or --ring");
+    // Change records carry no single date or task, so they only go to sinks written in order
+    if (options.Follow && (!options.ShardDirectory.empty() || !options.SegmentDirectory.empty() || !options.PartitionDirectory.empty()))
+        throw std::invalid_argument("--follow cannot be combined with --shard-dir, --segment-dir or --partition-dir");
+    return options;
+}
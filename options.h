@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+enum class EExportProfile {
+    // Ids, dates, senders and reply links
+    Ids,
+    // Ids plus message texts and captions
+    Text,
+    // Ids plus file references of attachments
+    Media,
+    Full
+};
+
+// Message field which partitioned output is split by
+enum class EPartitionKey {
+    // Month or day of the message date in UTC
+    Month,
+    Day,
+    // Hash bucket of the sender id
+    Sender,
+    Thread
+};
+
+// Unset fields do not restrict anything
+struct TMessageFilter {
+    // Inclusive lower and exclusive upper bound of message dates
+    std::int32_t MinDate = 0;
+    std::int32_t MaxDate = 0;
+    // Positive ids are users, negative ones are chats
+    long long SenderId = 0;
+    // Content type as written to the output, e.g. "photo" or "voice_note"
+    std::string ContentType;
+    long long ThreadId = 0;
+    // Substring of the message text or caption
+    std::string Contains;
+};
+
+struct TOptions {
+    long long ChatId = 0;
+    EExportProfile Profile = EExportProfile::Full;
+    TMessageFilter Filter;
+    // Number of date ranges fetched concurrently
+    std::size_t Shards = 1;
+    // Forum topics are fetched one by one with getMessageThreadHistory
+    bool Threads = false;
+    std::size_t MaxParallelTasks = 8;
+    // Directory to write shards or threads into separate files
+    std::string ShardDirectory;
+    bool DownloadMedia = false;
+    std::size_t MaxActiveDownloads = 4;
+    std::string MediaDirectory = "data/media";
+    // Invalid UTF-8 in strings is replaced with U+FFFD instead of being written as is
+    bool RepairUtf8 = false;
+    // Directory of the reply graph index built during the export, none when empty
+    std::string ReplyIndexDirectory;
+    // Directory of the full-text index of message texts and captions, none when empty
+    std::string TextIndexDirectory;
+    // Directory of size-rotated segment files with offset indices, none when empty
+    std::string SegmentDirectory;
+    std::size_t SegmentSize = 256 << 20;
+    // Messages per segment, unlimited when zero
+    std::size_t SegmentMessages = 0;
+    // Output files and stdout are written in the background through io_uring or writer threads
+    bool AsyncOutput = false;
+    // Shared memory ring which receives messages instead of stdout, none when empty
+    std::string RingPath;
+    std::size_t RingSize = 64 << 20;
+    // File written with group commit and resumed after a crash, none when empty
+    std::string OutputPath;
+    // Interval between commits of the output file
+    std::int64_t CommitInterval = 1000;
+    // Directory of partitions split by PartitionKey, none when empty
+    std::string PartitionDirectory;
+    EPartitionKey PartitionKey = EPartitionKey::Month;
+    // Buckets of sender partitions
+    std::size_t PartitionBuckets = 16;
+    std::size_t MaxOpenPartitions = 64;
+    // SQLite database which messages are upserted into instead of stdout, none when empty
+    std::string SqlitePath;
+    // After the history the fetcher keeps running and writes a change log of new, edited and deleted messages
+    bool Follow = false;
+    // Control socket of the daemon, which runs export jobs submitted through it one after another
+    std::string DaemonSocket;
+    // Index of the account in data/secrets.json which runs the export, the least used one when negative
+    int Account = -1;
+    // Logs chat updates to stderr
+    bool Verbose = false;
+    // JSON lines of all chats with estimated message counts, written once the chat lists are loaded
+    std::string ChatManifestPath;
+};
+
+// Parses command line arguments, throws std::invalid_argument on malformed input
+TOptions ParseOptions(int argc, char **argv);
@@ -0,0 +1,105 @@
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "output_page.h"
+
+
+namespace {
+    // Limit of vectors per writev call
+#if defined(IOV_MAX)
+    const std::size_t MaxVectors = IOV_MAX;
+#else
+    const std::size_t MaxVectors = 1024;
+#endif
+}
+
+
+void TOutputPage::Clear() {
+    Data.clear();
+    Splices.clear();
+    Records.clear();
+}
+
+void TOutputPage::EndRecord() {
+    Records.push_back({Data.size(), Splices.size()});
+    Data += '\n';
+}
+
+std::size_t TOutputPage::GetSize() const {
+    std::size_t size = Data.size();
+    for (const auto &splice : Splices)
+        size += splice.Size;
+    return size;
+}
+
+TOutputMark TOutputPage::GetRecordBegin(std::size_t index) const {
+    if (index == 0)
+        return {0, 0};
+    return {Records[index - 1].Offset + 1, Records[index - 1].Splice};
+}
+
+std::size_t TOutputPage::GetRecordSize(std::size_t index) const {
+    const TOutputMark begin = GetRecordBegin(index);
+    const TOutputMark &end = Records[index];
+    std::size_t size = end.Offset - begin.Offset;
+    for (std::size_t i = begin.Splice; i < end.Splice; ++i)
+        size += Splices[i].Size;
+    return size;
+}
+
+void TOutputPage::CopyRecord(std::size_t index, char *output) const {
+    const TOutputMark begin = GetRecordBegin(index);
+    const TOutputMark &end = Records[index];
+    std::size_t offset = begin.Offset;
+    for (std::size_t i = begin.Splice; i < end.Splice; ++i) {
+        const TOutputSplice &splice = Splices[i];
+        memcpy(output, Data.data() + offset, splice.Offset - offset);
+        output += splice.Offset - offset;
+        memcpy(output, splice.Data, splice.Size);
+        output += splice.Size;
+        offset = splice.Offset;
+    }
+    memcpy(output, Data.data() + offset, end.Offset - offset);
+}
+
+void TOutputPage::CopyTo(std::string &output) const {
+    output.reserve(output.size() + GetSize());
+    ForEachPart([&output](const char *data, std::size_t size) {
+        output.append(data, size);
+    });
+}
+
+bool TOutputPage::WriteTo(int fd, std::string &error) const {
+    std::vector<iovec> vectors;
+    vectors.reserve(Splices.size() * 2 + 1);
+    ForEachPart([&vectors](const char *data, std::size_t size) {
+        vectors.push_back({const_cast<char *>(data), size});
+    });
+
+    std::size_t index = 0;
+    while (index < vectors.size()) {
+        const std::size_t count = std::min(vectors.size() - index, MaxVectors);
+        const ssize_t written = writev(fd, vectors.data() + index, static_cast<int>(count));
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            error = strerror(errno);
+            return false;
+        }
+        // Skips what was written and resumes a partial write from the middle of a vector
+        std::size_t left = static_cast<std::size_t>(written);
+        while (index < vectors.size() && left >= vectors[index].iov_len)
+            left -= vectors[index++].iov_len;
+        if (left != 0) {
+            vectors[index].iov_base = static_cast<char *>(vectors[index].iov_base) + left;
+            vectors[index].iov_len -= left;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "json_writer.h"
+
+
+// Position in a page, splices before it are those with smaller indices
+struct TOutputMark {
+    std::size_t Offset;
+    std::size_t Splice;
+};
+
+// Serialised page of messages: bytes written by the JSON writer with long strings spliced in by reference.
+// The referenced strings belong to the messages of the page, so the page must be written before they are freed.
+struct TOutputPage {
+    std::string Data;
+    // Sorted by offset, several splices may share one
+    std::vector<TOutputSplice> Splices;
+    // Ends of records, each record is followed by a line feed
+    std::vector<TOutputMark> Records;
+
+    void Clear();
+    // Terminates the record written since the previous one
+    void EndRecord();
+    std::size_t GetSize() const;
+    // Position after the line feed of the previous record
+    TOutputMark GetRecordBegin(std::size_t index) const;
+    std::size_t GetRecordSize(std::size_t index) const;
+    // Copies the record without its line feed, output must have room for GetRecordSize bytes
+    void CopyRecord(std::size_t index, char *output) const;
+    // Appends the assembled page
+    void CopyTo(std::string &output) const;
+    // Calls function(data, size) for every contiguous part of the assembled page in order
+    template <class TFunction>
+    void ForEachPart(TFunction &&function) const {
+        std::size_t offset = 0;
+        for (const auto &splice : Splices) {
+            if (splice.Offset != offset)
+                function(Data.data() + offset, splice.Offset - offset);
+            function(splice.Data, splice.Size);
+            offset = splice.Offset;
+        }
+        if (offset != Data.size())
+            function(Data.data() + offset, Data.size() - offset);
+    }
+    // Gathers the page into the descriptor with writev, returns false and fills error on failure
+    bool WriteTo(int fd, std::string &error) const;
+};
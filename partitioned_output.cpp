@@ -0,0 +1,162 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+#include "media_store.h"
+#include "partitioned_output.h"
+
+
+namespace {
+    // Fixed multiplicative hash, so that buckets do not change between runs and builds
+    std::size_t GetBucket(long long value, std::size_t bucketCount) {
+        const std::uint64_t hash = static_cast<std::uint64_t>(value) * 0x9E3779B97F4A7C15ull;
+        return static_cast<std::size_t>((hash >> 32) % bucketCount);
+    }
+}
+
+
+TPartitionedOutput::TPartitionedOutput(const std::string &directory, const std::string &fileName, EPartitionKey key, std::size_t bucketCount,
+                                       std::size_t maxOpenFiles, std::size_t bufferSize, std::size_t maxBufferedBytes)
+    : Directory(directory)
+    , FileName(fileName)
+    , Key(key)
+    , BucketCount(std::max<std::size_t>(bucketCount, 1))
+    , MaxOpenFiles(std::max<std::size_t>(maxOpenFiles, 1))
+    , BufferSize(bufferSize)
+    , MaxBufferedBytes(maxBufferedBytes)
+{
+}
+
+TPartitionedOutput::~TPartitionedOutput() {
+    std::string error;
+    if (!Finish(error))
+        std::cerr << "Partitions " << Directory << ": " << error << std::endl;
+}
+
+std::string TPartitionedOutput::GetPartition(const TPartitionFields &fields) const {
+    char name[64];
+    const time_t date = fields.Date;
+    struct tm tm = {};
+    switch (Key) {
+        case EPartitionKey::Month:
+            gmtime_r(&date, &tm);
+            snprintf(name, sizeof(name), "month=%04d-%02d", tm.tm_year + 1900, tm.tm_mon + 1);
+            break;
+        case EPartitionKey::Day:
+            gmtime_r(&date, &tm);
+            snprintf(name, sizeof(name), "day=%04d-%02d-%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday);
+            break;
+        case EPartitionKey::Sender:
+            snprintf(name, sizeof(name), "sender_bucket=%zu", GetBucket(fields.SenderId, BucketCount));
+            break;
+        case EPartitionKey::Thread:
+            snprintf(name, sizeof(name), "thread=%lld", fields.ThreadId);
+            break;
+    }
+    return name;
+}
+
+bool TPartitionedOutput::Write(const TOutputPage &page, const std::vector<TPartitionFields> &fields, std::string &error) {
+    std::string name;
+    TPartition *partition = nullptr;
+    for (std::size_t i = 0; i < page.Records.size(); ++i) {
+        // Neighbouring messages usually share the partition
+        std::string next = GetPartition(fields[i]);
+        if (!partition || next != name) {
+            name.swap(next);
+            partition = &Partitions[name];
+            if (partition->Path.empty())
+                partition->Path = Directory + "/" + name + "/" + FileName;
+        }
+        const std::size_t size = page.GetRecordSize(i);
+        const std::size_t offset = partition->Buffer.size();
+        partition->Buffer.resize(offset + size + 1);
+        page.CopyRecord(i, &partition->Buffer[offset]);
+        partition->Buffer[offset + size] = '\n';
+        BufferedBytes += size + 1;
+        if (partition->Buffer.size() >= BufferSize && !Flush(*partition, error))
+            return false;
+    }
+    return BufferedBytes < MaxBufferedBytes || FlushAll(error);
+}
+
+bool TPartitionedOutput::Finish(std::string &error) {
+    bool ok = FlushAll(error);
+    while (!OpenFiles.empty())
+        ok = CloseFile(*OpenFiles.back(), error) && ok;
+    return ok;
+}
+
+std::size_t TPartitionedOutput::GetPartitionCount() const {
+    return Partitions.size();
+}
+
+bool TPartitionedOutput::Flush(TPartition &partition, std::string &error) {
+    if (partition.Buffer.empty())
+        return true;
+    if (partition.Fd < 0) {
+        if (!OpenFile(partition, error))
+            return false;
+    } else {
+        OpenFiles.splice(OpenFiles.begin(), OpenFiles, partition.Lru);
+    }
+    std::size_t done = 0;
+    while (done < partition.Buffer.size()) {
+        const ssize_t written = write(partition.Fd, partition.Buffer.data() + done, partition.Buffer.size() - done);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            error = "Cannot write " + partition.Path + ": " + strerror(errno);
+            return false;
+        }
+        done += static_cast<std::size_t>(written);
+    }
+    BufferedBytes -= partition.Buffer.size();
+    partition.Buffer.clear();
+    return true;
+}
+
+bool TPartitionedOutput::FlushAll(std::string &error) {
+    for (auto &item : Partitions) {
+        if (!Flush(item.second, error))
+            return false;
+        // Partitions written rarely do not keep their buffers
+        std::string().swap(item.second.Buffer);
+    }
+    return true;
+}
+
+bool TPartitionedOutput::OpenFile(TPartition &partition, std::string &error) {
+    if (OpenFiles.size() >= MaxOpenFiles && !CloseFile(*OpenFiles.back(), error))
+        return false;
+    if (!partition.Created)
+        MakeDirectories(partition.Path.substr(0, partition.Path.rfind('/')));
+    const int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (partition.Created ? O_APPEND : O_TRUNC);
+    partition.Fd = open(partition.Path.c_str(), flags, 0644);
+    if (partition.Fd < 0) {
+        error = "Cannot open " + partition.Path + ": " + strerror(errno);
+        return false;
+    }
+    partition.Created = true;
+    OpenFiles.push_front(&partition);
+    partition.Lru = OpenFiles.begin();
+    return true;
+}
+
+bool TPartitionedOutput::CloseFile(TPartition &partition, std::string &error) {
+    OpenFiles.erase(partition.Lru);
+    const int fd = partition.Fd;
+    partition.Fd = -1;
+    if (close(fd) != 0) {
+        error = "Cannot close " + partition.Path + ": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
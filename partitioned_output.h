@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "options.h"
+#include "output_page.h"
+
+
+// Fields of a message which its partition is chosen by
+struct TPartitionFields {
+    std::int32_t Date = 0;
+    long long SenderId = 0;
+    long long ThreadId = 0;
+};
+
+// Splits messages into Hive style partitions DIR/<key>=<value>/<file>, e.g. month=2024-05 or sender_bucket=7,
+// so downstream jobs read them in parallel without a reshuffle. Every partition has its own buffer which is
+// appended to its file once full, at most maxOpenFiles files are open at a time and the least recently written
+// one is closed to open another. Files are truncated when first opened, later reopens append.
+class TPartitionedOutput {
+    public:
+        // Senders are hashed into bucketCount buckets
+        TPartitionedOutput(const std::string &directory, const std::string &fileName, EPartitionKey key, std::size_t bucketCount,
+                           std::size_t maxOpenFiles, std::size_t bufferSize = 256 << 10, std::size_t maxBufferedBytes = 64 << 20);
+        ~TPartitionedOutput();
+
+        std::string GetPartition(const TPartitionFields &fields) const;
+        // Every record of the page, fields belong to the records in the same order
+        bool Write(const TOutputPage &page, const std::vector<TPartitionFields> &fields, std::string &error);
+        // Writes out every buffer and closes the files
+        bool Finish(std::string &error);
+        std::size_t GetPartitionCount() const;
+
+    private:
+        struct TPartition {
+            std::string Path;
+            std::string Buffer;
+            int Fd = -1;
+            bool Created = false;
+            // Position in OpenFiles while the file is open
+            std::list<TPartition *>::iterator Lru;
+        };
+
+        std::string Directory;
+        std::string FileName;
+        EPartitionKey Key;
+        std::size_t BucketCount;
+        std::size_t MaxOpenFiles;
+        std::size_t BufferSize;
+        std::size_t MaxBufferedBytes;
+        std::size_t BufferedBytes = 0;
+        std::unordered_map<std::string, TPartition> Partitions;
+        // Most recently written first
+        std::list<TPartition *> OpenFiles;
+
+        TPartitionedOutput(const TPartitionedOutput &) = delete;
+        TPartitionedOutput &operator = (const TPartitionedOutput &) = delete;
+        TPartitionedOutput(TPartitionedOutput &&) = delete;
+        TPartitionedOutput &&operator = (TPartitionedOutput &&) = delete;
+
+        bool Flush(TPartition &partition, std::string &error);
+        bool FlushAll(std::string &error);
+        bool OpenFile(TPartition &partition, std::string &error);
+        bool CloseFile(TPartition &partition, std::string &error);
+};
@@ -0,0 +1,76 @@
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+#include <td/telegram/td_api.hpp>
+
+#include <cctype>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "reflection.h"
+
+
+namespace {
+    // TDLib has no names of classes besides the beginning of their dumps, e.g. "messageGiveaway {"
+    std::string GetTdClassName(const td::td_api::BaseObject &object) {
+        const std::string dump = td::td_api::to_string(object);
+        return dump.substr(0, dump.find_first_of(" \n{"));
+    }
+
+    // "messageGiveaway" -> "giveaway", "messageChatJoinByLink" -> "chat_join_by_link"
+    std::string MakeTag(const std::string &name, const std::string &prefix) {
+        std::size_t begin = name.compare(0, prefix.size(), prefix) == 0 ? prefix.size() : 0;
+        std::string result;
+        for (std::size_t i = begin; i < name.size(); ++i) {
+            unsigned char c = static_cast<unsigned char>(name[i]);
+            if (std::isupper(c)) {
+                if (!result.empty())
+                    result += '_';
+                result += static_cast<char>(std::tolower(c));
+            } else {
+                result += static_cast<char>(c);
+            }
+        }
+        return result;
+    }
+}
+
+
+const std::string &GetTdTypeTag(const td::td_api::BaseObject &object, const char *prefix) {
+    static std::mutex mutex;
+    static std::unordered_map<std::int32_t, std::string> tags;
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = tags.find(object.get_id());
+    if (it != tags.end())
+        return it->second;
+    return tags.emplace(object.get_id(), MakeTag(GetTdClassName(object), prefix)).first->second;
+}
+
+namespace {
+    std::mutex UndescribedMutex;
+    // Class names by constructor id and counts by class name
+    std::unordered_map<std::int32_t, std::string> UndescribedNames;
+    std::map<std::string, std::size_t> UndescribedCounts;
+}
+
+void NoteUndescribedValue(const td::td_api::BaseObject &object) {
+    std::lock_guard<std::mutex> guard(UndescribedMutex);
+    auto it = UndescribedNames.find(object.get_id());
+    if (it == UndescribedNames.end()) {
+        it = UndescribedNames.emplace(object.get_id(), GetTdClassName(object)).first;
+        std::cerr << "TDLib class " << it->second << " has no descriptor, only its type is written" << std::endl;
+    }
+    ++UndescribedCounts[it->second];
+}
+
+std::vector<std::pair<std::string, std::size_t>> TakeUndescribedCounts() {
+    std::lock_guard<std::mutex> guard(UndescribedMutex);
+    std::vector<std::pair<std::string, std::size_t>> result(UndescribedCounts.begin(), UndescribedCounts.end());
+    UndescribedCounts.clear();
+    return result;
+}
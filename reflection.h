@@ -0,0 +1,280 @@
+#pragma once
+
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// Field descriptors for td_api objects.
+// Every serialisable class specialises TFields with a Name (the "type" tag written for polymorphic values)
+// and a static Get() returning a tuple of fields. TSerializer walks these tuples at compile time, so each
+// type gets its own straight-line serialisation code and fields outside of the export profile are not
+// compiled in at all. Writers only need BeginObject/EndObject/BeginArray/EndArray/Key/Null/Bool/Int/Double/String.
+
+enum EFieldGroup : unsigned {
+    FieldIds = 1u << 0,
+    FieldText = 1u << 1,
+    FieldMedia = 1u << 2,
+    FieldDetails = 1u << 3,
+    FieldAll = FieldIds | FieldText | FieldMedia | FieldDetails
+};
+
+enum EFieldFlag : unsigned {
+    // Fields of the nested object are written into the enclosing one
+    FieldInline = 1u << 0,
+    // Zero numbers, false, empty strings and empty arrays are not written
+    FieldOmitDefault = 1u << 1
+};
+
+template <class TClass, class TMember, unsigned Groups, unsigned Flags>
+struct TField {
+    const char *Name;
+    TMember TClass::*Member;
+};
+
+template <unsigned Groups = FieldDetails, class TClass, class TMember>
+constexpr TField<TClass, TMember, Groups, 0> Field(const char *name, TMember TClass::*member) {
+    return {name, member};
+}
+
+template <unsigned Groups = FieldDetails, class TClass, class TMember>
+constexpr TField<TClass, TMember, Groups, FieldOmitDefault> Optional(const char *name, TMember TClass::*member) {
+    return {name, member};
+}
+
+template <unsigned Groups = FieldAll, class TClass, class TMember>
+constexpr TField<TClass, TMember, Groups, FieldInline> Inline(TMember TClass::*member) {
+    return {nullptr, member};
+}
+
+template <class T>
+struct TFields;
+
+template <class T, class = void>
+struct THasFields : std::false_type {
+};
+
+template <class T>
+struct THasFields<T, decltype(void(TFields<T>::Get()))> : std::true_type {
+};
+
+// Type of a td_api object without descriptors, e.g. "giveaway" for messageGiveaway with the prefix "message".
+// Tags are kept in a table by constructor id, TDLib is asked for the class name once per class.
+const std::string &GetTdTypeTag(const td::td_api::BaseObject &object, const char *prefix);
+// Values without descriptors lose their fields: the first one of each class is logged and all of them are counted
+void NoteUndescribedValue(const td::td_api::BaseObject &object);
+// Counts by TDLib class name since the previous call
+std::vector<std::pair<std::string, std::size_t>> TakeUndescribedCounts();
+
+
+// Prefix stripped from TDLib names of polymorphic values which have no descriptors
+template <class TBase>
+struct TVariantPrefix {
+    static const char *Get() {
+        return "";
+    }
+};
+
+
+template <unsigned Profile>
+class TSerializer {
+    public:
+        template <class TWriter, class T>
+        static void Object(const T &object, TWriter &writer) {
+            writer.BeginObject();
+            Fields(object, writer);
+            writer.EndObject();
+        }
+
+        // Polymorphic values are tagged with "type", classes without descriptors are written as the type alone and reported
+        template <class TWriter, class TBase>
+        static void Variant(TBase &object, TWriter &writer) {
+            writer.BeginObject();
+            td::td_api::downcast_call(object, [&writer](auto &concrete) {
+                TSerializer::TaggedFields(concrete, writer, TVariantPrefix<TBase>::Get(), THasFields<std::decay_t<decltype(concrete)>>());
+            });
+            writer.EndObject();
+        }
+
+    private:
+        template <class TWriter, class T>
+        static void Fields(const T &object, TWriter &writer) {
+            const auto fields = TFields<T>::Get();
+            FieldsImpl(object, writer, fields, std::make_index_sequence<std::tuple_size<std::decay_t<decltype(fields)>>::value>());
+        }
+
+        template <class TWriter, class T, class TTuple, std::size_t... I>
+        static void FieldsImpl(const T &object, TWriter &writer, const TTuple &fields, std::index_sequence<I...>) {
+            int expand[] = {0, (WriteField(object, writer, std::get<I>(fields)), 0)...};
+            (void)expand;
+        }
+
+        template <class TWriter, class T, class TClass, class TMember, unsigned Groups, unsigned Flags>
+        static void WriteField(const T &object, TWriter &writer, const TField<TClass, TMember, Groups, Flags> &field) {
+            WriteField(
+                object.*field.Member, field.Name, writer,
+                std::integral_constant<bool, (Groups & Profile) != 0>(),
+                std::integral_constant<unsigned, Flags>()
+            );
+        }
+
+        template <class TWriter, class TMember, unsigned Flags>
+        static void WriteField(const TMember &, const char *, TWriter &, std::false_type, std::integral_constant<unsigned, Flags>) {
+        }
+
+        template <class TWriter, class TMember>
+        static void WriteField(const TMember &value, const char *name, TWriter &writer, std::true_type, std::integral_constant<unsigned, 0>) {
+            if (IsNull(value))
+                return;
+            writer.Key(name);
+            Value(value, writer);
+        }
+
+        template <class TWriter, class TMember>
+        static void WriteField(const TMember &value, const char *name, TWriter &writer, std::true_type, std::integral_constant<unsigned, FieldOmitDefault>) {
+            if (IsDefault(value))
+                return;
+            writer.Key(name);
+            Value(value, writer);
+        }
+
+        template <class TWriter, class TMember>
+        static void WriteField(const TMember &value, const char *, TWriter &writer, std::true_type, std::integral_constant<unsigned, FieldInline>) {
+            if (!value)
+                return;
+            InlineFields(*value, writer, std::is_abstract<std::decay_t<decltype(*value)>>());
+        }
+
+        template <class TWriter, class T>
+        static void InlineFields(T &object, TWriter &writer, std::false_type) {
+            Fields(object, writer);
+        }
+
+        template <class TWriter, class TBase>
+        static void InlineFields(TBase &object, TWriter &writer, std::true_type) {
+            td::td_api::downcast_call(object, [&writer](auto &concrete) {
+                TSerializer::UntaggedFields(concrete, writer, THasFields<std::decay_t<decltype(concrete)>>());
+            });
+        }
+
+        template <class TWriter, class T>
+        static void TaggedFields(T &object, TWriter &writer, const char *, std::true_type) {
+            writer.Key("type");
+            writer.String(TFields<T>::Name);
+            Fields(object, writer);
+        }
+
+        template <class TWriter, class T>
+        static void TaggedFields(T &object, TWriter &writer, const char *prefix, std::false_type) {
+            writer.Key("type");
+            writer.String(GetTdTypeTag(object, prefix));
+            NoteUndescribedValue(object);
+        }
+
+        template <class TWriter, class T>
+        static void UntaggedFields(T &object, TWriter &writer, std::true_type) {
+            Fields(object, writer);
+        }
+
+        template <class TWriter, class T>
+        static void UntaggedFields(T &, TWriter &, std::false_type) {
+        }
+
+        template <class TWriter>
+        static void Value(bool value, TWriter &writer) {
+            writer.Bool(value);
+        }
+
+        template <class TWriter>
+        static void Value(std::int32_t value, TWriter &writer) {
+            writer.Int(value);
+        }
+
+        template <class TWriter>
+        static void Value(std::int64_t value, TWriter &writer) {
+            writer.Int(value);
+        }
+
+        template <class TWriter>
+        static void Value(double value, TWriter &writer) {
+            writer.Double(value);
+        }
+
+        template <class TWriter>
+        static void Value(const std::string &value, TWriter &writer) {
+            writer.String(value);
+        }
+
+        template <class TWriter, class T>
+        static void Value(const td::td_api::object_ptr<T> &value, TWriter &writer) {
+            if (!value)
+                writer.Null();
+            else
+                ObjectValue(*value, writer, std::is_abstract<T>());
+        }
+
+        template <class TWriter, class T>
+        static void Value(const std::vector<T> &values, TWriter &writer) {
+            writer.BeginArray();
+            for (const auto &value : values)
+                Value(value, writer);
+            writer.EndArray();
+        }
+
+        template <class TWriter, class T>
+        static void ObjectValue(T &object, TWriter &writer, std::false_type) {
+            TFields<T>::Write(object, writer, TSerializer());
+        }
+
+        template <class TWriter, class TBase>
+        static void ObjectValue(TBase &object, TWriter &writer, std::true_type) {
+            Variant(object, writer);
+        }
+
+        template <class T>
+        static bool IsNull(const T &) {
+            return false;
+        }
+
+        template <class T>
+        static bool IsNull(const td::td_api::object_ptr<T> &value) {
+            return !value;
+        }
+
+        template <class T>
+        static bool IsDefault(const T &value) {
+            return value == T();
+        }
+
+        template <class T>
+        static bool IsDefault(const td::td_api::object_ptr<T> &value) {
+            return !value;
+        }
+
+        static bool IsDefault(const td::td_api::object_ptr<td::td_api::formattedText> &value) {
+            return !value || value->text_.empty();
+        }
+
+        template <class T>
+        static bool IsDefault(const std::vector<T> &value) {
+            return value.empty();
+        }
+};
+
+
+// Common part of TFields specialisations, Write can be hidden to give a class a custom representation
+template <class T>
+struct TFieldsBase {
+    template <class TWriter, unsigned Profile>
+    static void Write(T &object, TWriter &writer, TSerializer<Profile>) {
+        TSerializer<Profile>::Object(object, writer);
+    }
+};
@@ -0,0 +1,284 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <queue>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "media_store.h"
+#include "reply_index.h"
+
+
+bool operator < (const TMessageRef &lhs, const TMessageRef &rhs) {
+    return std::tie(lhs.ChatId, lhs.MessageId) < std::tie(rhs.ChatId, rhs.MessageId);
+}
+
+bool operator == (const TMessageRef &lhs, const TMessageRef &rhs) {
+    return lhs.ChatId == rhs.ChatId && lhs.MessageId == rhs.MessageId;
+}
+
+bool operator < (const TReplyRecord &lhs, const TReplyRecord &rhs) {
+    if (lhs.Key == rhs.Key)
+        return lhs.Value < rhs.Value;
+    return lhs.Key < rhs.Key;
+}
+
+bool operator == (const TReplyRecord &lhs, const TReplyRecord &rhs) {
+    return lhs.Key == rhs.Key && lhs.Value == rhs.Value;
+}
+
+
+namespace {
+    bool WriteRecords(const std::string &path, const std::vector<TReplyRecord> &records) {
+        FILE *file = fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+        bool ok = fwrite(records.data(), sizeof(TReplyRecord), records.size(), file) == records.size();
+        return fclose(file) == 0 && ok;
+    }
+
+    struct TRunReader {
+        FILE *File = nullptr;
+        TReplyRecord Current;
+
+        bool Next() {
+            return fread(&Current, sizeof(Current), 1, File) == 1;
+        }
+    };
+
+    bool ReadRecord(int fd, std::int64_t index, TReplyRecord &record) {
+        const ssize_t size = sizeof(record);
+        return pread(fd, &record, sizeof(record), static_cast<off_t>(index * size)) == size;
+    }
+
+    // All records with the given key, found with a binary search over the file
+    std::vector<TMessageRef> LookupValues(int fd, const TMessageRef &key) {
+        std::vector<TMessageRef> result;
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+            return result;
+        const std::int64_t count = st.st_size / static_cast<std::int64_t>(sizeof(TReplyRecord));
+        std::int64_t left = 0, right = count;
+        TReplyRecord record;
+        while (left < right) {
+            const std::int64_t middle = left + (right - left) / 2;
+            if (!ReadRecord(fd, middle, record))
+                return result;
+            if (record.Key < key)
+                left = middle + 1;
+            else
+                right = middle;
+        }
+        for (std::int64_t i = left; i < count && ReadRecord(fd, i, record) && record.Key == key; ++i)
+            result.push_back(record.Value);
+        return result;
+    }
+
+    void PrintTree(const TReplyIndexReader &reader, const TMessageRef &message, const TMessageRef &selected, std::size_t depth, std::set<std::pair<std::int64_t, std::int64_t>> &visited) {
+        if (!visited.insert({message.ChatId, message.MessageId}).second)
+            return;
+        std::cout << std::string(depth * 2, ' ') << message.ChatId << ' ' << message.MessageId;
+        if (message == selected)
+            std::cout << " *";
+        std::cout << '\n';
+        for (const auto &child : reader.GetChildren(message))
+            PrintTree(reader, child, selected, depth + 1, visited);
+    }
+}
+
+
+TReplyIndexWriter::TReplyIndexWriter(const std::string &directory, std::size_t maxBufferedEdges)
+    : Directory(directory)
+    , MaxBufferedEdges(std::max<std::size_t>(maxBufferedEdges, 1))
+{
+    MakeDirectories(Directory + "/runs");
+    Buffer.reserve(MaxBufferedEdges);
+}
+
+void TReplyIndexWriter::Add(const TMessageRef &parent, const TMessageRef &child) {
+    Buffer.push_back({parent, child});
+    if (Buffer.size() >= MaxBufferedEdges && !FlushRun())
+        std::cerr << "Reply index: " << Error << std::endl;
+}
+
+bool TReplyIndexWriter::Finish(std::string &error) {
+    // Edges of a run which failed to spill are lost, the index is merged anyway but reported as incomplete
+    const std::string lost = Error;
+    bool ok = (Buffer.empty() || FlushRun())
+        && MergeRuns("children", Directory + "/children.bin")
+        && MergeRuns("parents", Directory + "/parents.bin");
+    for (std::size_t run = 0; run < RunCount; ++run) {
+        unlink(GetRunPath("children", run).c_str());
+        unlink(GetRunPath("parents", run).c_str());
+    }
+    rmdir((Directory + "/runs").c_str());
+    RunCount = 0;
+    if (!ok)
+        error = Error;
+    else if (!lost.empty())
+        error = lost;
+    return ok && lost.empty();
+}
+
+std::string TReplyIndexWriter::GetRunPath(const char *kind, std::size_t run) const {
+    char name[64];
+    snprintf(name, sizeof(name), "/runs/%s_%05zu.bin", kind, run);
+    return Directory + name;
+}
+
+bool TReplyIndexWriter::FlushRun() {
+    // The same edges are spilled twice: sorted by parent and, with key and value swapped, by child
+    std::sort(Buffer.begin(), Buffer.end());
+    if (!WriteRecords(GetRunPath("children", RunCount), Buffer)) {
+        Error = "Cannot write " + GetRunPath("children", RunCount) + ": " + strerror(errno);
+        Buffer.clear();
+        return false;
+    }
+    for (auto &record : Buffer)
+        std::swap(record.Key, record.Value);
+    std::sort(Buffer.begin(), Buffer.end());
+    if (!WriteRecords(GetRunPath("parents", RunCount), Buffer)) {
+        Error = "Cannot write " + GetRunPath("parents", RunCount) + ": " + strerror(errno);
+        Buffer.clear();
+        return false;
+    }
+    Buffer.clear();
+    ++RunCount;
+    return true;
+}
+
+bool TReplyIndexWriter::MergeRuns(const char *kind, const std::string &path) {
+    // The index left by earlier exports is one more sorted run, so other chats in the directory are kept
+    std::vector<TRunReader> runs(RunCount + 1);
+    auto greater = [&runs](std::size_t lhs, std::size_t rhs) {
+        return runs[rhs].Current < runs[lhs].Current;
+    };
+    std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(greater)> heap(greater);
+    bool ok = true;
+    for (std::size_t run = 0; run < RunCount; ++run) {
+        runs[run].File = fopen(GetRunPath(kind, run).c_str(), "rb");
+        if (!runs[run].File) {
+            Error = "Cannot read " + GetRunPath(kind, run) + ": " + strerror(errno);
+            ok = false;
+            break;
+        }
+        if (runs[run].Next())
+            heap.push(run);
+    }
+    runs[RunCount].File = ok ? fopen(path.c_str(), "rb") : nullptr;
+    if (ok && !runs[RunCount].File && errno != ENOENT) {
+        Error = "Cannot read " + path + ": " + strerror(errno);
+        ok = false;
+    }
+    if (runs[RunCount].File && runs[RunCount].Next())
+        heap.push(RunCount);
+    const std::string temporary = path + ".tmp";
+    FILE *output = ok ? fopen(temporary.c_str(), "wb") : nullptr;
+    if (ok && !output) {
+        Error = "Cannot write " + temporary + ": " + strerror(errno);
+        ok = false;
+    }
+    if (ok) {
+        // Duplicate edges, e.g. of a message exported by two overlapping runs, are written once
+        bool hasLast = false;
+        TReplyRecord last;
+        while (!heap.empty()) {
+            const std::size_t run = heap.top();
+            heap.pop();
+            if (!hasLast || !(last == runs[run].Current)) {
+                last = runs[run].Current;
+                hasLast = true;
+                if (fwrite(&last, sizeof(last), 1, output) != 1) {
+                    Error = "Cannot write " + temporary + ": " + strerror(errno);
+                    ok = false;
+                    break;
+                }
+            }
+            if (runs[run].Next())
+                heap.push(run);
+        }
+        if (fclose(output) != 0 && ok) {
+            Error = "Cannot write " + temporary + ": " + strerror(errno);
+            ok = false;
+        }
+    }
+    for (auto &run : runs)
+        if (run.File)
+            fclose(run.File);
+    if (ok && rename(temporary.c_str(), path.c_str()) != 0) {
+        Error = "Cannot rename " + temporary + ": " + strerror(errno);
+        ok = false;
+    }
+    if (!ok && output)
+        unlink(temporary.c_str());
+    return ok;
+}
+
+
+TReplyIndexReader::TReplyIndexReader(const std::string &directory)
+    : ChildrenFd(open((directory + "/children.bin").c_str(), O_RDONLY))
+    , ParentsFd(open((directory + "/parents.bin").c_str(), O_RDONLY))
+{
+}
+
+TReplyIndexReader::~TReplyIndexReader() {
+    if (ChildrenFd >= 0)
+        close(ChildrenFd);
+    if (ParentsFd >= 0)
+        close(ParentsFd);
+}
+
+bool TReplyIndexReader::IsOpen() const {
+    return ChildrenFd >= 0 && ParentsFd >= 0;
+}
+
+std::vector<TMessageRef> TReplyIndexReader::GetChildren(const TMessageRef &message) const {
+    return LookupValues(ChildrenFd, message);
+}
+
+bool TReplyIndexReader::GetParent(const TMessageRef &message, TMessageRef &parent) const {
+    auto parents = LookupValues(ParentsFd, message);
+    if (parents.empty())
+        return false;
+    parent = parents.front();
+    return true;
+}
+
+
+int RunReplyQuery(int argc, char **argv) {
+    if (argc != 4) {
+        std::cerr << "Usage: fetcher replies <index_dir> <chat_id> <message_id>" << std::endl;
+        return 1;
+    }
+    TReplyIndexReader reader(argv[1]);
+    if (!reader.IsOpen()) {
+        std::cerr << "Cannot open reply index in " << argv[1] << std::endl;
+        return 1;
+    }
+    TMessageRef selected;
+    try {
+        selected.ChatId = std::stoll(argv[2]);
+        selected.MessageId = std::stoll(argv[3]);
+    } catch (const std::exception &ex) {
+        std::cerr << "Malformed message reference: " << ex.what() << std::endl;
+        return 1;
+    }
+    // Climbs to the root of the conversation, replies never form cycles but the walk is bounded anyway
+    TMessageRef root = selected;
+    std::set<std::pair<std::int64_t, std::int64_t>> visited;
+    TMessageRef parent;
+    while (visited.insert({root.ChatId, root.MessageId}).second && reader.GetParent(root, parent))
+        root = parent;
+    visited.clear();
+    PrintTree(reader, root, selected, 0, visited);
+    return 0;
+}
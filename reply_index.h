@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+struct TMessageRef {
+    std::int64_t ChatId = 0;
+    std::int64_t MessageId = 0;
+};
+
+// Fixed size record of an index file, sorted by key and then by value
+struct TReplyRecord {
+    TMessageRef Key;
+    TMessageRef Value;
+};
+
+bool operator < (const TMessageRef &lhs, const TMessageRef &rhs);
+bool operator == (const TMessageRef &lhs, const TMessageRef &rhs);
+bool operator < (const TReplyRecord &lhs, const TReplyRecord &rhs);
+bool operator == (const TReplyRecord &lhs, const TReplyRecord &rhs);
+
+// Builds the reply graph of exported messages with bounded memory.
+// Edges are buffered, sorted and spilled into runs, Finish merges the runs and the existing index into
+// children.bin (parent -> child) and parents.bin (child -> parent).
+class TReplyIndexWriter {
+    public:
+        TReplyIndexWriter(const std::string &directory, std::size_t maxBufferedEdges = 1 << 20);
+
+        void Add(const TMessageRef &parent, const TMessageRef &child);
+        // Merges all runs into the index files, returns false and fills error on failure
+        bool Finish(std::string &error);
+
+    private:
+        std::string Directory;
+        std::size_t MaxBufferedEdges;
+        std::vector<TReplyRecord> Buffer;
+        std::size_t RunCount = 0;
+        std::string Error;
+
+        TReplyIndexWriter(const TReplyIndexWriter &) = delete;
+        TReplyIndexWriter &operator = (const TReplyIndexWriter &) = delete;
+        TReplyIndexWriter(TReplyIndexWriter &&) = delete;
+        TReplyIndexWriter &&operator = (TReplyIndexWriter &&) = delete;
+
+        std::string GetRunPath(const char *kind, std::size_t run) const;
+        bool FlushRun();
+        bool MergeRuns(const char *kind, const std::string &path);
+};
+
+// Looks edges up in the index files with binary search, nothing is loaded into memory
+class TReplyIndexReader {
+    public:
+        explicit TReplyIndexReader(const std::string &directory);
+        ~TReplyIndexReader();
+
+        bool IsOpen() const;
+        std::vector<TMessageRef> GetChildren(const TMessageRef &message) const;
+        bool GetParent(const TMessageRef &message, TMessageRef &parent) const;
+
+    private:
+        int ChildrenFd = -1;
+        int ParentsFd = -1;
+
+        TReplyIndexReader(const TReplyIndexReader &) = delete;
+        TReplyIndexReader &operator = (const TReplyIndexReader &) = delete;
+        TReplyIndexReader(TReplyIndexReader &&) = delete;
+        TReplyIndexReader &&operator = (TReplyIndexReader &&) = delete;
+};
+
+// "fetcher replies DIR CHAT_ID MESSAGE_ID", prints the conversation tree the message belongs to
+int RunReplyQuery(int argc, char **argv);
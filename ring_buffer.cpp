@@ -0,0 +1,347 @@
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include "output_page.h"
+#include "ring_buffer.h"
+
+
+// Every field is either written once before Magic or is a lock-free atomic, which works across processes.
+// Positions of the two sides live on separate cache lines.
+struct TRingHeader {
+    std::atomic<std::uint64_t> Magic;
+    std::uint64_t Capacity;
+    std::int32_t ProducerPid;
+    std::atomic<std::int32_t> ConsumerPid;
+
+    alignas(64) std::atomic<std::uint64_t> Head;
+    std::atomic<std::uint32_t> HeadSignal;
+    std::atomic<std::uint32_t> ConsumerWaiting;
+    std::atomic<std::uint32_t> Closed;
+
+    alignas(64) std::atomic<std::uint64_t> Tail;
+    std::atomic<std::uint32_t> TailSignal;
+    std::atomic<std::uint32_t> ProducerWaiting;
+};
+
+
+namespace {
+    // "FTCHRNG1"
+    const std::uint64_t RingMagic = 0x31474e5248435446ull;
+    const std::size_t HeaderSize = 4096;
+    const std::uint32_t SkipLength = 0xFFFFFFFF;
+    // Sleeps are bounded to notice that the other side has exited
+    const time_t WaitSeconds = 1;
+
+    static_assert(sizeof(TRingHeader) <= HeaderSize, "Ring header does not fit into its page");
+
+    std::uint64_t GetRecordSize(std::size_t size) {
+        return (sizeof(std::uint32_t) + size + 7) & ~static_cast<std::uint64_t>(7);
+    }
+
+    void WaitFor(std::atomic<std::uint32_t> &signal, std::uint32_t value) {
+        timespec timeout = {WaitSeconds, 0};
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&signal), FUTEX_WAIT, value, &timeout, nullptr, 0);
+    }
+
+    void Wake(std::atomic<std::uint32_t> &signal) {
+        signal.fetch_add(1);
+        syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&signal), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+    }
+
+    bool IsAlive(pid_t pid) {
+        return kill(pid, 0) == 0 || errno == EPERM;
+    }
+
+    void Unmap(void *&memory, std::size_t size, int &fd) {
+        if (memory)
+            munmap(memory, size);
+        memory = nullptr;
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+}
+
+
+TRingWriter::~TRingWriter() {
+    Close();
+    Unmap(Memory, MappedSize, Fd);
+}
+
+bool TRingWriter::Open(const std::string &path, std::size_t capacity, std::string &error) {
+    Capacity = HeaderSize;
+    while (Capacity < capacity)
+        Capacity <<= 1;
+    // A consumer of a previous run keeps its own file instead of seeing this one reset under it
+    if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+        error = strerror(errno);
+        return false;
+    }
+    Fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (Fd < 0) {
+        error = strerror(errno);
+        return false;
+    }
+    MappedSize = HeaderSize + Capacity;
+    if (ftruncate(Fd, static_cast<off_t>(MappedSize)) != 0) {
+        error = strerror(errno);
+        return false;
+    }
+    void *memory = mmap(nullptr, MappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+    if (memory == MAP_FAILED) {
+        error = strerror(errno);
+        return false;
+    }
+    Memory = memory;
+    Header = new (Memory) TRingHeader();
+    Header->Capacity = Capacity;
+    Header->ProducerPid = getpid();
+    Header->Magic.store(RingMagic);
+    Ring = static_cast<char *>(Memory) + HeaderSize;
+    Head = 0;
+    Tail = 0;
+    return true;
+}
+
+bool TRingWriter::Write(const char *data, std::size_t size, std::string &error) {
+    char *output = Reserve(size, error);
+    if (!output)
+        return false;
+    memcpy(output, data, size);
+    Publish();
+    return true;
+}
+
+bool TRingWriter::Write(const TOutputPage &page, std::string &error) {
+    for (std::size_t i = 0; i < page.Records.size(); ++i) {
+        const std::size_t size = page.GetRecordSize(i);
+        char *output = Reserve(size, error);
+        if (!output)
+            return false;
+        page.CopyRecord(i, output);
+    }
+    Publish();
+    return true;
+}
+
+void TRingWriter::SetStopFlag(const std::atomic<bool> *stop) {
+    Stop = stop;
+}
+
+void TRingWriter::Close() {
+    if (!Header || Header->Closed.load())
+        return;
+    Publish();
+    Header->Closed.store(1);
+    Wake(Header->HeadSignal);
+}
+
+char *TRingWriter::Reserve(std::size_t size, std::string &error) {
+    const std::uint64_t recordSize = GetRecordSize(size);
+    if (size >= SkipLength || recordSize > Capacity) {
+        error = "record of " + std::to_string(size) + " bytes does not fit into the ring";
+        return nullptr;
+    }
+    std::uint64_t offset = Head & (Capacity - 1);
+    if (Capacity - offset < recordSize) {
+        // Records are contiguous, the end of the ring is skipped, it is at least 8 bytes long
+        if (!WaitForSpace(Capacity - offset, error))
+            return nullptr;
+        memcpy(Ring + offset, &SkipLength, sizeof(SkipLength));
+        Head += Capacity - offset;
+        offset = 0;
+    }
+    if (!WaitForSpace(recordSize, error))
+        return nullptr;
+    const std::uint32_t length = static_cast<std::uint32_t>(size);
+    memcpy(Ring + offset, &length, sizeof(length));
+    Head += recordSize;
+    return Ring + offset + sizeof(length);
+}
+
+bool TRingWriter::WaitForSpace(std::size_t size, std::string &error) {
+    while (Head + size - Tail > Capacity) {
+        Tail = Header->Tail.load(std::memory_order_acquire);
+        if (Head + size - Tail <= Capacity)
+            break;
+        // Records written so far must be visible before sleeping, otherwise the consumer may wait for them as well
+        Publish();
+        const std::uint32_t signal = Header->TailSignal.load();
+        Header->ProducerWaiting.store(1);
+        Tail = Header->Tail.load();
+        if (Head + size - Tail > Capacity) {
+            // Without a consumer the producer waits for one to attach, the bounded sleep notices a stop
+            const pid_t consumer = Header->ConsumerPid.load();
+            if (consumer != 0 && !IsAlive(consumer)) {
+                Header->ProducerWaiting.store(0);
+                error = "consumer " + std::to_string(consumer) + " exited";
+                return false;
+            }
+            if (Stop && Stop->load()) {
+                Header->ProducerWaiting.store(0);
+                error = consumer != 0 ? "stopped while the ring is full" : "stopped while waiting for a consumer to attach";
+                return false;
+            }
+            WaitFor(Header->TailSignal, signal);
+        }
+        Header->ProducerWaiting.store(0);
+    }
+    return true;
+}
+
+void TRingWriter::Publish() {
+    if (Header->Head.load(std::memory_order_relaxed) == Head)
+        return;
+    // Sequentially consistent store and load, so either the consumer sees the new head or the producer sees it waiting
+    Header->Head.store(Head);
+    if (Header->ConsumerWaiting.load())
+        Wake(Header->HeadSignal);
+}
+
+
+TRingReader::~TRingReader() {
+    if (Header) {
+        if (NextTail != Tail)
+            Release(NextTail);
+        std::int32_t pid = getpid();
+        Header->ConsumerPid.compare_exchange_strong(pid, 0);
+    }
+    Unmap(Memory, MappedSize, Fd);
+}
+
+bool TRingReader::Open(const std::string &path, std::string &error) {
+    Fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (Fd < 0) {
+        error = strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(Fd, &st) != 0) {
+        error = strerror(errno);
+        return false;
+    }
+    if (static_cast<std::size_t>(st.st_size) < HeaderSize) {
+        error = "not a ring";
+        return false;
+    }
+    void *memory = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+    if (memory == MAP_FAILED) {
+        error = strerror(errno);
+        return false;
+    }
+    Memory = memory;
+    MappedSize = static_cast<std::size_t>(st.st_size);
+    TRingHeader *header = static_cast<TRingHeader *>(Memory);
+    if (header->Magic.load() != RingMagic || HeaderSize + header->Capacity != MappedSize) {
+        error = "not a ring or not initialised yet";
+        return false;
+    }
+    std::int32_t consumer = header->ConsumerPid.load();
+    do {
+        if (consumer != 0 && IsAlive(consumer)) {
+            error = "ring is already read by process " + std::to_string(consumer);
+            return false;
+        }
+    } while (!header->ConsumerPid.compare_exchange_weak(consumer, getpid()));
+    Header = header;
+    Capacity = Header->Capacity;
+    Ring = static_cast<const char *>(Memory) + HeaderSize;
+    // A consumer which replaces an exited one starts after the last released record
+    Tail = NextTail = Head = Header->Tail.load();
+    return true;
+}
+
+bool TRingReader::Next(const char *&data, std::size_t &size, std::string &error) {
+    error.clear();
+    if (NextTail != Tail)
+        Release(NextTail);
+    for (;;) {
+        if (Head == Tail) {
+            if (!WaitForData(error))
+                return false;
+            continue;
+        }
+        const std::uint64_t offset = Tail & (Capacity - 1);
+        std::uint32_t length = 0;
+        memcpy(&length, Ring + offset, sizeof(length));
+        if (length == SkipLength) {
+            Release(Tail + Capacity - offset);
+            continue;
+        }
+        data = Ring + offset + sizeof(length);
+        size = length;
+        NextTail = Tail + GetRecordSize(length);
+        return true;
+    }
+}
+
+void TRingReader::Release(std::uint64_t tail) {
+    Tail = NextTail = tail;
+    Header->Tail.store(tail);
+    if (Header->ProducerWaiting.load())
+        Wake(Header->TailSignal);
+}
+
+bool TRingReader::WaitForData(std::string &error) {
+    Head = Header->Head.load(std::memory_order_acquire);
+    if (Head != Tail)
+        return true;
+    const std::uint32_t signal = Header->HeadSignal.load();
+    Header->ConsumerWaiting.store(1);
+    // The producer publishes the head before closing, so a closed ring with nothing new is over
+    const bool closed = Header->Closed.load() != 0;
+    Head = Header->Head.load();
+    bool result = true;
+    if (Head == Tail) {
+        if (closed) {
+            result = false;
+        } else if (!IsAlive(Header->ProducerPid)) {
+            error = "producer " + std::to_string(Header->ProducerPid) + " exited without closing the ring";
+            result = false;
+        } else {
+            WaitFor(Header->HeadSignal, signal);
+        }
+    }
+    Header->ConsumerWaiting.store(0);
+    return result;
+}
+
+
+int RunRingDump(int argc, char **argv) {
+    if (argc != 2) {
+        std::cerr << "Usage: fetcher ring <path>" << std::endl;
+        return 1;
+    }
+    TRingReader reader;
+    std::string error;
+    if (!reader.Open(argv[1], error)) {
+        std::cerr << "Cannot open ring " << argv[1] << ": " << error << std::endl;
+        return 1;
+    }
+    const char *data = nullptr;
+    std::size_t size = 0;
+    while (reader.Next(data, size, error)) {
+        fwrite(data, 1, size, stdout);
+        fputc('\n', stdout);
+    }
+    fflush(stdout);
+    if (!error.empty()) {
+        std::cerr << "Failed to read ring " << argv[1] << ": " << error << std::endl;
+        return 1;
+    }
+    return 0;
+}
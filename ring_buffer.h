@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "output_page.h"
+
+
+// Shared part of the ring, laid out at the start of the file
+struct TRingHeader;
+
+// Single producer, single consumer ring of records in a memory mapped file, meant for /dev/shm.
+// The file is a page of positions followed by the ring, whose capacity is a power of two.
+// A record is its 32-bit length and the bytes, padded to 8 bytes; the length 0xFFFFFFFF skips to the start of the ring.
+// Positions only grow. A side which finds the ring full or empty sleeps on a futex in the header and is woken
+// by the other one, which makes a system call only when it sees a sleeper.
+class TRingWriter {
+    public:
+        TRingWriter() = default;
+        ~TRingWriter();
+
+        // Replaces the file with an empty ring, capacity is rounded up to a power of two
+        bool Open(const std::string &path, std::size_t capacity, std::string &error);
+        // A write waiting for space fails once the flag is set, the flag outlives the writer
+        void SetStopFlag(const std::atomic<bool> *stop);
+        // Waits while the ring is full, so a slow consumer holds the producer back.
+        // Waits for a consumer to attach and fails once the attached one exits or the stop flag is set.
+        bool Write(const char *data, std::size_t size, std::string &error);
+        // Every record of the page, without line feeds, published at once
+        bool Write(const TOutputPage &page, std::string &error);
+        // Marks the end of the stream, the consumer reads what is left and stops
+        void Close();
+
+    private:
+        int Fd = -1;
+        void *Memory = nullptr;
+        std::size_t MappedSize = 0;
+        TRingHeader *Header = nullptr;
+        char *Ring = nullptr;
+        std::uint64_t Capacity = 0;
+        // Written but not yet published position and the last seen position of the consumer
+        std::uint64_t Head = 0;
+        std::uint64_t Tail = 0;
+        const std::atomic<bool> *Stop = nullptr;
+
+        TRingWriter(const TRingWriter &) = delete;
+        TRingWriter &operator = (const TRingWriter &) = delete;
+        TRingWriter(TRingWriter &&) = delete;
+        TRingWriter &&operator = (TRingWriter &&) = delete;
+
+        // Claims a record and returns the place for its bytes, nullptr on failure
+        char *Reserve(std::size_t size, std::string &error);
+        bool WaitForSpace(std::size_t size, std::string &error);
+        void Publish();
+};
+
+// Consumer side of TRingWriter, the ring has at most one consumer at a time
+class TRingReader {
+    public:
+        TRingReader() = default;
+        ~TRingReader();
+
+        bool Open(const std::string &path, std::string &error);
+        // Waits for the next record, which stays valid until the next call.
+        // Returns false at the end of the stream and also fills error when the producer exited without closing it.
+        bool Next(const char *&data, std::size_t &size, std::string &error);
+
+    private:
+        int Fd = -1;
+        void *Memory = nullptr;
+        std::size_t MappedSize = 0;
+        TRingHeader *Header = nullptr;
+        const char *Ring = nullptr;
+        std::uint64_t Capacity = 0;
+        // Position of the record being read, the one after it and the last seen position of the producer
+        std::uint64_t Tail = 0;
+        std::uint64_t NextTail = 0;
+        std::uint64_t Head = 0;
+
+        TRingReader(const TRingReader &) = delete;
+        TRingReader &operator = (const TRingReader &) = delete;
+        TRingReader(TRingReader &&) = delete;
+        TRingReader &&operator = (TRingReader &&) = delete;
+
+        void Release(std::uint64_t tail);
+        bool WaitForData(std::string &error);
+};
+
+// "fetcher ring PATH", prints records of the ring as lines until the producer closes it
+int RunRingDump(int argc, char **argv);
@@ -0,0 +1,320 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "media_store.h"
+#include "output_page.h"
+#include "segment_store.h"
+
+
+namespace {
+    std::string GetSegmentName(std::size_t segment) {
+        char name[32];
+        snprintf(name, sizeof(name), "seg_%06zu", segment);
+        return name;
+    }
+
+    // Numbers of segments with the given extension, in increasing order
+    std::vector<std::size_t> ListSegments(const std::string &directory, const char *extension) {
+        std::vector<std::size_t> result;
+        DIR *dir = opendir(directory.c_str());
+        if (!dir)
+            return result;
+        while (dirent *entry = readdir(dir)) {
+            std::size_t segment = 0;
+            char suffix[8] = {};
+            int length = 0;
+            if (sscanf(entry->d_name, "seg_%zu.%7s%n", &segment, suffix, &length) == 2
+                && entry->d_name[length] == '\0' && strcmp(suffix, extension) == 0)
+                result.push_back(segment);
+        }
+        closedir(dir);
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    bool ReadEntry(int fd, std::int64_t index, TSegmentEntry &entry) {
+        const ssize_t size = sizeof(entry);
+        return pread(fd, &entry, sizeof(entry), static_cast<off_t>(index * size)) == size;
+    }
+
+    // Index of the first entry in [begin, end) which is not less than the value
+    template <class TLess>
+    std::int64_t LowerBound(int fd, std::int64_t begin, std::int64_t end, TSegmentEntry &entry, TLess less) {
+        while (begin < end) {
+            const std::int64_t middle = begin + (end - begin) / 2;
+            if (!ReadEntry(fd, middle, entry))
+                return -1;
+            if (less(entry))
+                begin = middle + 1;
+            else
+                end = middle;
+        }
+        return begin;
+    }
+}
+
+
+constexpr std::size_t TSegmentWriter::WriteBufferSize;
+
+TSegmentWriter::TSegmentWriter(const std::string &directory, std::size_t maxSegmentBytes, std::size_t maxSegmentMessages)
+    : Directory(directory)
+    , MaxSegmentBytes(std::max<std::size_t>(maxSegmentBytes, 1))
+    , MaxSegmentMessages(maxSegmentMessages)
+{
+    MakeDirectories(Directory);
+    const auto segments = ListSegments(Directory, "jsonl");
+    if (!segments.empty())
+        NextSegment = segments.back() + 1;
+}
+
+TSegmentWriter::~TSegmentWriter() {
+    std::string error;
+    if (!Finish(error))
+        std::cerr << "Segment " << SegmentName << ": " << error << std::endl;
+}
+
+bool TSegmentWriter::Write(const TOutputPage &page, const std::vector<TSegmentEntry> &entries, std::string &error) {
+    for (std::size_t i = 0; i < page.Records.size(); ++i) {
+        const std::size_t size = page.GetRecordSize(i);
+        const bool full = Used + size + 1 > Capacity || (MaxSegmentMessages != 0 && Entries.size() >= MaxSegmentMessages);
+        if (Fd < 0 || full) {
+            if (!CloseSegment(error) || !OpenSegment(std::max(MaxSegmentBytes, size + 1), error))
+                return false;
+        }
+        char *record = Memory + Used;
+        if (!Memory) {
+            Buffer.resize(Buffer.size() + size + 1);
+            record = &Buffer[Buffer.size() - size - 1];
+        }
+        page.CopyRecord(i, record);
+        record[size] = '\n';
+        TSegmentEntry entry = entries[i];
+        entry.Offset = static_cast<std::int64_t>(Used);
+        entry.Size = static_cast<std::uint32_t>(size);
+        Entries.push_back(entry);
+        Used += size + 1;
+    }
+    return Buffer.size() < WriteBufferSize || FlushBuffer(error);
+}
+
+bool TSegmentWriter::Finish(std::string &error) {
+    return CloseSegment(error);
+}
+
+bool TSegmentWriter::OpenSegment(std::size_t size, std::string &error) {
+    SegmentName = GetSegmentName(NextSegment++);
+    const std::string path = Directory + "/" + SegmentName + ".jsonl";
+    Fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (Fd < 0) {
+        error = "Cannot create " + path + ": " + strerror(errno);
+        return false;
+    }
+    Capacity = size;
+    Used = 0;
+    // Extents are reserved upfront so the file does not fragment and stores into the mapping cannot run out of space
+    if (fallocate(Fd, 0, 0, static_cast<off_t>(size)) != 0) {
+        if (!Unmapped)
+            std::cerr << "Cannot preallocate " << path << " (" << strerror(errno) << "), segments are written without a mapping" << std::endl;
+        Unmapped = true;
+        return true;
+    }
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+    if (memory == MAP_FAILED) {
+        error = "Cannot map " + path + ": " + strerror(errno);
+        close(Fd);
+        Fd = -1;
+        return false;
+    }
+    Memory = static_cast<char *>(memory);
+    return true;
+}
+
+bool TSegmentWriter::CloseSegment(std::string &error) {
+    if (Fd < 0)
+        return true;
+    bool ok = true;
+    if (Memory) {
+        munmap(Memory, Capacity);
+        Memory = nullptr;
+    } else {
+        ok = FlushBuffer(error);
+    }
+    Capacity = 0;
+    Buffer.clear();
+    // The preallocated tail is given back
+    if (ok && ftruncate(Fd, static_cast<off_t>(Used)) != 0) {
+        error = "Cannot finish " + SegmentName + ".jsonl: " + strerror(errno);
+        ok = false;
+    }
+    if (close(Fd) != 0 && ok) {
+        error = "Cannot finish " + SegmentName + ".jsonl: " + strerror(errno);
+        ok = false;
+    }
+    Fd = -1;
+    ok = WriteIndex(error) && ok;
+    Entries.clear();
+    return ok;
+}
+
+bool TSegmentWriter::FlushBuffer(std::string &error) {
+    std::size_t offset = 0;
+    while (offset < Buffer.size()) {
+        const off_t position = static_cast<off_t>(Used - Buffer.size() + offset);
+        const ssize_t size = pwrite(Fd, Buffer.data() + offset, Buffer.size() - offset, position);
+        if (size < 0 && errno == EINTR)
+            continue;
+        if (size < 0) {
+            error = "Cannot write " + SegmentName + ".jsonl: " + strerror(errno);
+            return false;
+        }
+        offset += static_cast<std::size_t>(size);
+    }
+    Buffer.clear();
+    return true;
+}
+
+bool TSegmentWriter::WriteIndex(std::string &error) {
+    const std::string path = Directory + "/" + SegmentName + ".idx";
+    FILE *file = fopen((path + ".tmp").c_str(), "wb");
+    if (!file) {
+        error = "Cannot write " + path + ": " + strerror(errno);
+        return false;
+    }
+    std::sort(Entries.begin(), Entries.end(), [](const TSegmentEntry &lhs, const TSegmentEntry &rhs) {
+        return lhs.MessageId < rhs.MessageId;
+    });
+    bool ok = fwrite(Entries.data(), sizeof(TSegmentEntry), Entries.size(), file) == Entries.size();
+    std::stable_sort(Entries.begin(), Entries.end(), [](const TSegmentEntry &lhs, const TSegmentEntry &rhs) {
+        return lhs.Date < rhs.Date;
+    });
+    ok = fwrite(Entries.data(), sizeof(TSegmentEntry), Entries.size(), file) == Entries.size() && ok;
+    ok = fclose(file) == 0 && ok;
+    // Readers only see complete indices
+    if (!ok || rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+        error = "Cannot write " + path + ": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+
+TSegmentReader::TSegmentReader(const std::string &directory)
+    : Directory(directory)
+{
+    for (std::size_t number : ListSegments(Directory, "idx")) {
+        TSegment segment;
+        segment.Name = GetSegmentName(number);
+        segment.IndexFd = open((Directory + "/" + segment.Name + ".idx").c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (segment.IndexFd < 0 || fstat(segment.IndexFd, &st) != 0) {
+            if (segment.IndexFd >= 0)
+                close(segment.IndexFd);
+            continue;
+        }
+        segment.Count = st.st_size / static_cast<std::int64_t>(2 * sizeof(TSegmentEntry));
+        Segments.push_back(segment);
+    }
+}
+
+TSegmentReader::~TSegmentReader() {
+    for (const auto &segment : Segments)
+        close(segment.IndexFd);
+}
+
+bool TSegmentReader::IsOpen() const {
+    return !Segments.empty();
+}
+
+bool TSegmentReader::FindMessage(std::int64_t messageId, TSegmentLocation &location) const {
+    TSegmentEntry entry;
+    for (const auto &segment : Segments) {
+        const std::int64_t index = LowerBound(segment.IndexFd, 0, segment.Count, entry, [messageId](const TSegmentEntry &entry) {
+            return entry.MessageId < messageId;
+        });
+        if (index >= 0 && index < segment.Count && ReadEntry(segment.IndexFd, index, entry) && entry.MessageId == messageId) {
+            location.Path = Directory + "/" + segment.Name + ".jsonl";
+            location.Entry = entry;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TSegmentReader::FindDate(std::int32_t date, TSegmentLocation &location) const {
+    bool found = false;
+    TSegmentEntry entry;
+    for (const auto &segment : Segments) {
+        // Entries sorted by date follow the ones sorted by id
+        const std::int64_t index = LowerBound(segment.IndexFd, segment.Count, 2 * segment.Count, entry, [date](const TSegmentEntry &entry) {
+            return entry.Date < date;
+        });
+        if (index < 0 || index >= 2 * segment.Count || !ReadEntry(segment.IndexFd, index, entry))
+            continue;
+        if (!found || entry.Date < location.Entry.Date || (entry.Date == location.Entry.Date && entry.MessageId < location.Entry.MessageId)) {
+            location.Path = Directory + "/" + segment.Name + ".jsonl";
+            location.Entry = entry;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool TSegmentReader::ReadLine(const TSegmentLocation &location, std::string &line) const {
+    const int fd = open(location.Path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    line.resize(location.Entry.Size);
+    const ssize_t size = static_cast<ssize_t>(line.size());
+    const bool ok = pread(fd, &line[0], line.size(), static_cast<off_t>(location.Entry.Offset)) == size;
+    close(fd);
+    return ok;
+}
+
+
+int RunSegmentSeek(int argc, char **argv) {
+    const std::string kind = argc == 4 ? argv[2] : "";
+    if (kind != "id" && kind != "date") {
+        std::cerr << "Usage: fetcher seek <segment_dir> id|date <value>" << std::endl;
+        return 1;
+    }
+    TSegmentReader reader(argv[1]);
+    if (!reader.IsOpen()) {
+        std::cerr << "No indexed segments in " << argv[1] << std::endl;
+        return 1;
+    }
+    long long value = 0;
+    try {
+        value = std::stoll(argv[3]);
+    } catch (const std::exception &ex) {
+        std::cerr << "Malformed " << kind << ": " << ex.what() << std::endl;
+        return 1;
+    }
+    TSegmentLocation location;
+    const bool found = kind == "id"
+        ? reader.FindMessage(value, location)
+        : reader.FindDate(static_cast<std::int32_t>(value), location);
+    if (!found) {
+        std::cerr << "No message found" << std::endl;
+        return 1;
+    }
+    std::string line;
+    if (!reader.ReadLine(location, line)) {
+        std::cerr << "Cannot read " << location.Path << std::endl;
+        return 1;
+    }
+    std::cerr << location.Path << ':' << location.Entry.Offset << std::endl;
+    std::cout << line << std::endl;
+    return 0;
+}
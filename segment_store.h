@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "output_page.h"
+
+
+// Fixed size record of a sidecar index, locates one line of a segment
+struct TSegmentEntry {
+    std::int64_t MessageId = 0;
+    std::int64_t Offset = 0;
+    std::int32_t Date = 0;
+    // Length of the line without the line feed
+    std::uint32_t Size = 0;
+};
+
+// Writes messages into numbered segments seg_NNNNNN.jsonl, a segment is rotated once it reaches
+// the size or message limit. Segments are preallocated with fallocate and filled through a shared
+// mapping, closing one trims it to its contents and writes the sidecar seg_NNNNNN.idx: its entries
+// sorted by message id followed by the same entries sorted by date. Where fallocate fails a store into
+// the mapping could hit a full disk and end in SIGBUS, so such segments are buffered and written with pwrite.
+// Writing into an existing directory continues after its last segment.
+class TSegmentWriter {
+    public:
+        // A limit of zero messages means that segments are rotated by size only
+        TSegmentWriter(const std::string &directory, std::size_t maxSegmentBytes, std::size_t maxSegmentMessages);
+        ~TSegmentWriter();
+
+        // Every record of the page, entries give message ids and dates of the records in the same order
+        bool Write(const TOutputPage &page, const std::vector<TSegmentEntry> &entries, std::string &error);
+        // Closes the current segment, returns false and fills error on failure
+        bool Finish(std::string &error);
+
+    private:
+        std::string Directory;
+        std::size_t MaxSegmentBytes;
+        std::size_t MaxSegmentMessages;
+        std::size_t NextSegment = 0;
+        static constexpr std::size_t WriteBufferSize = 1 << 20;
+
+        int Fd = -1;
+        // Mapping of a preallocated segment, nullptr when the segment is written through Buffer
+        char *Memory = nullptr;
+        std::string Buffer;
+        std::size_t Capacity = 0;
+        std::size_t Used = 0;
+        // Some segment could not be preallocated, which is reported once
+        bool Unmapped = false;
+        std::string SegmentName;
+        std::vector<TSegmentEntry> Entries;
+
+        TSegmentWriter(const TSegmentWriter &) = delete;
+        TSegmentWriter &operator = (const TSegmentWriter &) = delete;
+        TSegmentWriter(TSegmentWriter &&) = delete;
+        TSegmentWriter &&operator = (TSegmentWriter &&) = delete;
+
+        bool OpenSegment(std::size_t size, std::string &error);
+        bool CloseSegment(std::string &error);
+        // Writes the buffered tail of the segment, which ends at Used
+        bool FlushBuffer(std::string &error);
+        bool WriteIndex(std::string &error);
+};
+
+// Position of a message found through the sidecar indices
+struct TSegmentLocation {
+    std::string Path;
+    TSegmentEntry Entry;
+};
+
+// Looks messages up in the sidecar indices with binary search, nothing is loaded into memory.
+// Segments without an index, e.g. the one being written, are not searched.
+class TSegmentReader {
+    public:
+        explicit TSegmentReader(const std::string &directory);
+        ~TSegmentReader();
+
+        bool IsOpen() const;
+        bool FindMessage(std::int64_t messageId, TSegmentLocation &location) const;
+        // The earliest message sent at the date or later
+        bool FindDate(std::int32_t date, TSegmentLocation &location) const;
+        bool ReadLine(const TSegmentLocation &location, std::string &line) const;
+
+    private:
+        struct TSegment {
+            std::string Name;
+            int IndexFd = -1;
+            std::int64_t Count = 0;
+        };
+
+        std::string Directory;
+        std::vector<TSegment> Segments;
+
+        TSegmentReader(const TSegmentReader &) = delete;
+        TSegmentReader &operator = (const TSegmentReader &) = delete;
+        TSegmentReader(TSegmentReader &&) = delete;
+        TSegmentReader &&operator = (TSegmentReader &&) = delete;
+};
+
+// "fetcher seek DIR id|date VALUE", prints the line of the message with the id or of the first one at the date
+int RunSegmentSeek(int argc, char **argv);
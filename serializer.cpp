@@ -0,0 +1,875 @@
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+#include <td/telegram/td_api.hpp>
+
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "json_writer.h"
+#include "options.h"
+#include "output_page.h"
+#include "reflection.h"
+#include "serializer.h"
+
+
+namespace api = td::td_api;
+
+template <>
+struct TVariantPrefix<api::MessageContent> {
+    static const char *Get() {
+        return "message";
+    }
+};
+
+template <>
+struct TVariantPrefix<api::MessageSender> {
+    static const char *Get() {
+        return "messageSender";
+    }
+};
+
+template <>
+struct TVariantPrefix<api::MessageOrigin> {
+    static const char *Get() {
+        return "messageOrigin";
+    }
+};
+
+template <>
+struct TVariantPrefix<api::PollType> {
+    static const char *Get() {
+        return "pollType";
+    }
+};
+
+
+// Texts are exported as plain strings, entities are not kept
+template <>
+struct TFields<api::formattedText> {
+    template <class TWriter, unsigned Profile>
+    static void Write(api::formattedText &text, TWriter &writer, TSerializer<Profile>) {
+        writer.String(text.text_);
+    }
+};
+
+template <>
+struct TFields<api::remoteFile> : TFieldsBase<api::remoteFile> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Optional<FieldMedia>("remote_file_id", &api::remoteFile::id_),
+            Optional<FieldMedia>("media_key", &api::remoteFile::unique_id_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::file> : TFieldsBase<api::file> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldMedia>("file_id", &api::file::id_),
+            Optional<FieldMedia>("size", &api::file::size_),
+            Inline<FieldMedia>(&api::file::remote_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::photoSize> : TFieldsBase<api::photoSize> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("type", &api::photoSize::type_),
+            Field("width", &api::photoSize::width_),
+            Field("height", &api::photoSize::height_),
+            Inline<FieldMedia>(&api::photoSize::photo_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::photo> : TFieldsBase<api::photo> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldMedia | FieldDetails>("sizes", &api::photo::sizes_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::chatPhoto> : TFieldsBase<api::chatPhoto> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldMedia | FieldDetails>("sizes", &api::chatPhoto::sizes_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::video> : TFieldsBase<api::video> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("duration", &api::video::duration_),
+            Field("width", &api::video::width_),
+            Field("height", &api::video::height_),
+            Optional("file_name", &api::video::file_name_),
+            Optional("mime_type", &api::video::mime_type_),
+            Inline<FieldMedia>(&api::video::video_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::document> : TFieldsBase<api::document> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Optional("file_name", &api::document::file_name_),
+            Optional("mime_type", &api::document::mime_type_),
+            Inline<FieldMedia>(&api::document::document_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::audio> : TFieldsBase<api::audio> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("duration", &api::audio::duration_),
+            Optional("title", &api::audio::title_),
+            Optional("performer", &api::audio::performer_),
+            Optional("file_name", &api::audio::file_name_),
+            Optional("mime_type", &api::audio::mime_type_),
+            Inline<FieldMedia>(&api::audio::audio_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::animation> : TFieldsBase<api::animation> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("duration", &api::animation::duration_),
+            Field("width", &api::animation::width_),
+            Field("height", &api::animation::height_),
+            Optional("file_name", &api::animation::file_name_),
+            Optional("mime_type", &api::animation::mime_type_),
+            Inline<FieldMedia>(&api::animation::animation_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::sticker> : TFieldsBase<api::sticker> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("sticker_id", &api::sticker::id_),
+            Field("set_id", &api::sticker::set_id_),
+            Field<FieldText | FieldDetails>("emoji", &api::sticker::emoji_),
+            Field("width", &api::sticker::width_),
+            Field("height", &api::sticker::height_),
+            Inline<FieldMedia>(&api::sticker::sticker_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::voiceNote> : TFieldsBase<api::voiceNote> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("duration", &api::voiceNote::duration_),
+            Inline<FieldMedia>(&api::voiceNote::voice_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::videoNote> : TFieldsBase<api::videoNote> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("duration", &api::videoNote::duration_),
+            Field("length", &api::videoNote::length_),
+            Inline<FieldMedia>(&api::videoNote::video_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::location> : TFieldsBase<api::location> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("latitude", &api::location::latitude_),
+            Field("longitude", &api::location::longitude_),
+            Optional("horizontal_accuracy", &api::location::horizontal_accuracy_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::venue> : TFieldsBase<api::venue> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::venue::location_),
+            Field<FieldText | FieldDetails>("title", &api::venue::title_),
+            Field<FieldText | FieldDetails>("address", &api::venue::address_),
+            Optional("provider", &api::venue::provider_),
+            Optional("venue_id", &api::venue::id_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::contact> : TFieldsBase<api::contact> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("phone_number", &api::contact::phone_number_),
+            Field("first_name", &api::contact::first_name_),
+            Optional("last_name", &api::contact::last_name_),
+            Optional("vcard", &api::contact::vcard_),
+            Optional("user_id", &api::contact::user_id_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::pollOption> : TFieldsBase<api::pollOption> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldText | FieldDetails>("text", &api::pollOption::text_),
+            Field("voter_count", &api::pollOption::voter_count_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::pollTypeRegular> : TFieldsBase<api::pollTypeRegular> {
+    static constexpr const char *Name = "regular";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("allow_multiple_answers", &api::pollTypeRegular::allow_multiple_answers_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::pollTypeQuiz> : TFieldsBase<api::pollTypeQuiz> {
+    static constexpr const char *Name = "quiz";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("correct_option_id", &api::pollTypeQuiz::correct_option_id_),
+            Optional<FieldText | FieldDetails>("explanation", &api::pollTypeQuiz::explanation_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::poll> : TFieldsBase<api::poll> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("poll_id", &api::poll::id_),
+            Field<FieldText | FieldDetails>("question", &api::poll::question_),
+            Field<FieldText | FieldDetails>("options", &api::poll::options_),
+            Field("total_voter_count", &api::poll::total_voter_count_),
+            Field("is_anonymous", &api::poll::is_anonymous_),
+            Field("poll_type", &api::poll::type_),
+            Field("is_closed", &api::poll::is_closed_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::game> : TFieldsBase<api::game> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("game_id", &api::game::id_),
+            Field("short_name", &api::game::short_name_),
+            Field<FieldText | FieldDetails>("title", &api::game::title_),
+            Optional<FieldText | FieldDetails>("description", &api::game::description_)
+        );
+    }
+};
+
+
+template <>
+struct TFields<api::messageText> : TFieldsBase<api::messageText> {
+    static constexpr const char *Name = "text";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldText>("text", &api::messageText::text_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messagePhoto> : TFieldsBase<api::messagePhoto> {
+    static constexpr const char *Name = "photo";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::messagePhoto::photo_),
+            Optional<FieldText>("caption", &api::messagePhoto::caption_),
+            Optional("has_spoiler", &api::messagePhoto::has_spoiler_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageVideo> : TFieldsBase<api::messageVideo> {
+    static constexpr const char *Name = "video";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::messageVideo::video_),
+            Optional<FieldText>("caption", &api::messageVideo::caption_),
+            Optional("has_spoiler", &api::messageVideo::has_spoiler_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageDocument> : TFieldsBase<api::messageDocument> {
+    static constexpr const char *Name = "document";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::messageDocument::document_),
+            Optional<FieldText>("caption", &api::messageDocument::caption_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageAudio> : TFieldsBase<api::messageAudio> {
+    static constexpr const char *Name = "audio";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::messageAudio::audio_),
+            Optional<FieldText>("caption", &api::messageAudio::caption_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageAnimation> : TFieldsBase<api::messageAnimation> {
+    static constexpr const char *Name = "animation";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::messageAnimation::animation_),
+            Optional<FieldText>("caption", &api::messageAnimation::caption_),
+            Optional("has_spoiler", &api::messageAnimation::has_spoiler_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageSticker> : TFieldsBase<api::messageSticker> {
+    static constexpr const char *Name = "sticker";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::messageSticker::sticker_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageVoiceNote> : TFieldsBase<api::messageVoiceNote> {
+    static constexpr const char *Name = "voice_note";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::messageVoiceNote::voice_note_),
+            Optional<FieldText>("caption", &api::messageVoiceNote::caption_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageVideoNote> : TFieldsBase<api::messageVideoNote> {
+    static constexpr const char *Name = "video_note";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::messageVideoNote::video_note_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageLocation> : TFieldsBase<api::messageLocation> {
+    static constexpr const char *Name = "location";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::messageLocation::location_),
+            Optional("live_period", &api::messageLocation::live_period_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageVenue> : TFieldsBase<api::messageVenue> {
+    static constexpr const char *Name = "venue";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::messageVenue::venue_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageContact> : TFieldsBase<api::messageContact> {
+    static constexpr const char *Name = "contact";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::messageContact::contact_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageAnimatedEmoji> : TFieldsBase<api::messageAnimatedEmoji> {
+    static constexpr const char *Name = "animated_emoji";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldText | FieldDetails>("emoji", &api::messageAnimatedEmoji::emoji_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageDice> : TFieldsBase<api::messageDice> {
+    static constexpr const char *Name = "dice";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("emoji", &api::messageDice::emoji_),
+            Field("value", &api::messageDice::value_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageGame> : TFieldsBase<api::messageGame> {
+    static constexpr const char *Name = "game";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::messageGame::game_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messagePoll> : TFieldsBase<api::messagePoll> {
+    static constexpr const char *Name = "poll";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::messagePoll::poll_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageStory> : TFieldsBase<api::messageStory> {
+    static constexpr const char *Name = "story";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("story_sender_chat_id", &api::messageStory::story_sender_chat_id_),
+            Field("story_id", &api::messageStory::story_id_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageInvoice> : TFieldsBase<api::messageInvoice> {
+    static constexpr const char *Name = "invoice";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldText | FieldDetails>("title", &api::messageInvoice::title_),
+            Optional<FieldText | FieldDetails>("description", &api::messageInvoice::description_),
+            Field("currency", &api::messageInvoice::currency_),
+            Field("total_amount", &api::messageInvoice::total_amount_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageCall> : TFieldsBase<api::messageCall> {
+    static constexpr const char *Name = "call";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("is_video", &api::messageCall::is_video_),
+            Field("duration", &api::messageCall::duration_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageBasicGroupChatCreate> : TFieldsBase<api::messageBasicGroupChatCreate> {
+    static constexpr const char *Name = "basic_group_chat_create";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldText | FieldDetails>("title", &api::messageBasicGroupChatCreate::title_),
+            Field("member_user_ids", &api::messageBasicGroupChatCreate::member_user_ids_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageSupergroupChatCreate> : TFieldsBase<api::messageSupergroupChatCreate> {
+    static constexpr const char *Name = "supergroup_chat_create";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldText | FieldDetails>("title", &api::messageSupergroupChatCreate::title_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageChatChangeTitle> : TFieldsBase<api::messageChatChangeTitle> {
+    static constexpr const char *Name = "chat_change_title";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldText | FieldDetails>("title", &api::messageChatChangeTitle::title_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageChatChangePhoto> : TFieldsBase<api::messageChatChangePhoto> {
+    static constexpr const char *Name = "chat_change_photo";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Inline(&api::messageChatChangePhoto::photo_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageChatAddMembers> : TFieldsBase<api::messageChatAddMembers> {
+    static constexpr const char *Name = "chat_add_members";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("member_user_ids", &api::messageChatAddMembers::member_user_ids_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageChatDeleteMember> : TFieldsBase<api::messageChatDeleteMember> {
+    static constexpr const char *Name = "chat_delete_member";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("user_id", &api::messageChatDeleteMember::user_id_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageChatUpgradeTo> : TFieldsBase<api::messageChatUpgradeTo> {
+    static constexpr const char *Name = "chat_upgrade_to";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("supergroup_id", &api::messageChatUpgradeTo::supergroup_id_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageChatUpgradeFrom> : TFieldsBase<api::messageChatUpgradeFrom> {
+    static constexpr const char *Name = "chat_upgrade_from";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldText | FieldDetails>("title", &api::messageChatUpgradeFrom::title_),
+            Field("basic_group_id", &api::messageChatUpgradeFrom::basic_group_id_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messagePinMessage> : TFieldsBase<api::messagePinMessage> {
+    static constexpr const char *Name = "pin_message";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("message_id", &api::messagePinMessage::message_id_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageChatSetMessageAutoDeleteTime> : TFieldsBase<api::messageChatSetMessageAutoDeleteTime> {
+    static constexpr const char *Name = "chat_set_message_auto_delete_time";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("message_auto_delete_time", &api::messageChatSetMessageAutoDeleteTime::message_auto_delete_time_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageForumTopicCreated> : TFieldsBase<api::messageForumTopicCreated> {
+    static constexpr const char *Name = "forum_topic_created";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldText | FieldDetails>("name", &api::messageForumTopicCreated::name_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageForumTopicEdited> : TFieldsBase<api::messageForumTopicEdited> {
+    static constexpr const char *Name = "forum_topic_edited";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Optional<FieldText | FieldDetails>("name", &api::messageForumTopicEdited::name_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageForumTopicIsClosedToggled> : TFieldsBase<api::messageForumTopicIsClosedToggled> {
+    static constexpr const char *Name = "forum_topic_is_closed_toggled";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("is_closed", &api::messageForumTopicIsClosedToggled::is_closed_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageForumTopicIsHiddenToggled> : TFieldsBase<api::messageForumTopicIsHiddenToggled> {
+    static constexpr const char *Name = "forum_topic_is_hidden_toggled";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("is_hidden", &api::messageForumTopicIsHiddenToggled::is_hidden_)
+        );
+    }
+};
+
+
+// Service messages which carry nothing but their type
+template <class T>
+struct TMarkerFields : TFieldsBase<T> {
+    static constexpr auto Get() {
+        return std::make_tuple();
+    }
+};
+
+template <>
+struct TFields<api::messageChatDeletePhoto> : TMarkerFields<api::messageChatDeletePhoto> {
+    static constexpr const char *Name = "chat_delete_photo";
+};
+
+template <>
+struct TFields<api::messageChatJoinByLink> : TMarkerFields<api::messageChatJoinByLink> {
+    static constexpr const char *Name = "chat_join_by_link";
+};
+
+template <>
+struct TFields<api::messageChatJoinByRequest> : TMarkerFields<api::messageChatJoinByRequest> {
+    static constexpr const char *Name = "chat_join_by_request";
+};
+
+template <>
+struct TFields<api::messageScreenshotTaken> : TMarkerFields<api::messageScreenshotTaken> {
+    static constexpr const char *Name = "screenshot_taken";
+};
+
+template <>
+struct TFields<api::messageContactRegistered> : TMarkerFields<api::messageContactRegistered> {
+    static constexpr const char *Name = "contact_registered";
+};
+
+template <>
+struct TFields<api::messageExpiredPhoto> : TMarkerFields<api::messageExpiredPhoto> {
+    static constexpr const char *Name = "expired_photo";
+};
+
+template <>
+struct TFields<api::messageExpiredVideo> : TMarkerFields<api::messageExpiredVideo> {
+    static constexpr const char *Name = "expired_video";
+};
+
+template <>
+struct TFields<api::messageUnsupported> : TMarkerFields<api::messageUnsupported> {
+    static constexpr const char *Name = "unsupported";
+};
+
+
+template <>
+struct TFields<api::messageSenderUser> : TFieldsBase<api::messageSenderUser> {
+    static constexpr const char *Name = "user";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldIds>("user_id", &api::messageSenderUser::user_id_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageSenderChat> : TFieldsBase<api::messageSenderChat> {
+    static constexpr const char *Name = "chat";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldIds>("chat_id", &api::messageSenderChat::chat_id_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageReplyToMessage> : TFieldsBase<api::messageReplyToMessage> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldIds>("reply_to_chat_id", &api::messageReplyToMessage::chat_id_),
+            Field<FieldIds>("reply_to_message_id", &api::messageReplyToMessage::message_id_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageReplyToStory> : TFieldsBase<api::messageReplyToStory> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldIds>("reply_to_story_sender_chat_id", &api::messageReplyToStory::story_sender_chat_id_),
+            Field<FieldIds>("reply_to_story_id", &api::messageReplyToStory::story_id_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageOriginUser> : TFieldsBase<api::messageOriginUser> {
+    static constexpr const char *Name = "user";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("sender_user_id", &api::messageOriginUser::sender_user_id_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageOriginChat> : TFieldsBase<api::messageOriginChat> {
+    static constexpr const char *Name = "chat";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("sender_chat_id", &api::messageOriginChat::sender_chat_id_),
+            Optional("author_signature", &api::messageOriginChat::author_signature_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageOriginChannel> : TFieldsBase<api::messageOriginChannel> {
+    static constexpr const char *Name = "channel";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("chat_id", &api::messageOriginChannel::chat_id_),
+            Field("message_id", &api::messageOriginChannel::message_id_),
+            Optional("author_signature", &api::messageOriginChannel::author_signature_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageOriginHiddenUser> : TFieldsBase<api::messageOriginHiddenUser> {
+    static constexpr const char *Name = "hidden_user";
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("sender_name", &api::messageOriginHiddenUser::sender_name_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::messageForwardInfo> : TFieldsBase<api::messageForwardInfo> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field("origin", &api::messageForwardInfo::origin_),
+            Field("date", &api::messageForwardInfo::date_),
+            Optional("from_chat_id", &api::messageForwardInfo::from_chat_id_),
+            Optional("from_message_id", &api::messageForwardInfo::from_message_id_)
+        );
+    }
+};
+
+template <>
+struct TFields<api::message> : TFieldsBase<api::message> {
+    static constexpr auto Get() {
+        return std::make_tuple(
+            Field<FieldIds>("id", &api::message::id_),
+            Field<FieldIds>("chat_id", &api::message::chat_id_),
+            Inline<FieldIds>(&api::message::reply_to_),
+            Field<FieldIds>("message_thread_id", &api::message::message_thread_id_),
+            Field<FieldIds>("date", &api::message::date_),
+            Field<FieldIds>("edit_date", &api::message::edit_date_),
+            Field<FieldIds>("sender", &api::message::sender_id_),
+            Optional("forward_info", &api::message::forward_info_),
+            Optional("media_album_id", &api::message::media_album_id_),
+            Optional("author_signature", &api::message::author_signature_),
+            Optional("is_outgoing", &api::message::is_outgoing_),
+            Optional("is_pinned", &api::message::is_pinned_),
+            Field<FieldText | FieldMedia | FieldDetails>("content", &api::message::content_)
+        );
+    }
+};
+
+
+namespace {
+    template <class T>
+    std::string GetTypeName(T &, std::true_type) {
+        return TFields<T>::Name;
+    }
+
+    template <class T>
+    std::string GetTypeName(T &object, std::false_type) {
+        return GetTdTypeTag(object, TVariantPrefix<api::MessageContent>::Get());
+    }
+
+    void WriteMessage(const td::td_api::message &message, EExportProfile profile, TJsonWriter &writer) {
+        switch (profile) {
+            case EExportProfile::Ids:
+                TSerializer<FieldIds>::Object(message, writer);
+                break;
+            case EExportProfile::Text:
+                TSerializer<FieldIds | FieldText>::Object(message, writer);
+                break;
+            case EExportProfile::Media:
+                TSerializer<FieldIds | FieldMedia>::Object(message, writer);
+                break;
+            case EExportProfile::Full:
+                TSerializer<FieldAll>::Object(message, writer);
+                break;
+        }
+    }
+}
+
+
+bool SerializeMessage(const td::td_api::message &message, EExportProfile profile, bool repairUtf8, TOutputPage &page) {
+    TJsonWriter writer(page.Data, repairUtf8, &page.Splices);
+    WriteMessage(message, profile, writer);
+    return writer.IsValidUtf8();
+}
+
+bool SerializeMessageChange(EMessageChange change, const td::td_api::message &message, EExportProfile profile, bool repairUtf8, TOutputPage &page) {
+    TJsonWriter writer(page.Data, repairUtf8, &page.Splices);
+    writer.BeginObject();
+    writer.Key("change");
+    writer.String(change == EMessageChange::Insert ? "insert" : "edit");
+    writer.Key("message");
+    WriteMessage(message, profile, writer);
+    writer.EndObject();
+    return writer.IsValidUtf8();
+}
+
+void SerializeDeletion(long long chatId, const std::vector<std::int64_t> &messageIds, TOutputPage &page) {
+    TJsonWriter writer(page.Data);
+    writer.BeginObject();
+    writer.Key("change");
+    writer.String("delete");
+    writer.Key("chat_id");
+    writer.Int(chatId);
+    writer.Key("message_ids");
+    writer.BeginArray();
+    for (std::int64_t messageId : messageIds)
+        writer.Int(messageId);
+    writer.EndArray();
+    writer.EndObject();
+}
+
+std::string GetContentType(td::td_api::MessageContent &content) {
+    std::string result;
+    td::td_api::downcast_call(content, [&result](auto &concrete) {
+        result = GetTypeName(concrete, THasFields<std::decay_t<decltype(concrete)>>());
+    });
+    return result;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <td/telegram/Client.h>
+#include <td/telegram/td_api.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "options.h"
+#include "output_page.h"
+
+
+// Appends the message as JSON without a trailing newline, fields outside of the profile are not even looked at.
+// Long strings are referenced from the page, so the message must outlive it.
+// Returns false when some string was not valid UTF-8, such strings are repaired with U+FFFD if requested.
+bool SerializeMessage(const td::td_api::message &message, EExportProfile profile, bool repairUtf8, TOutputPage &page);
+enum class EMessageChange {
+    Insert,
+    Edit
+};
+
+// Appends a change log record {"change": "insert" or "edit", "message": {...}} without a trailing newline
+bool SerializeMessageChange(EMessageChange change, const td::td_api::message &message, EExportProfile profile, bool repairUtf8, TOutputPage &page);
+// Appends a change log record {"change": "delete", "chat_id": ..., "message_ids": [...]} without a trailing newline
+void SerializeDeletion(long long chatId, const std::vector<std::int64_t> &messageIds, TOutputPage &page);
+// Content type as written into the "type" field of the content
+std::string GetContentType(td::td_api::MessageContent &content);
@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "sqlite_store.h"
+
+#if defined(FETCHER_SQLITE)
+#include <sqlite3.h>
+
+
+namespace {
+    const char *const Schema =
+        "CREATE TABLE IF NOT EXISTS messages ("
+        "chat_id INTEGER NOT NULL, message_id INTEGER NOT NULL, date INTEGER NOT NULL, edit_date INTEGER NOT NULL, "
+        "sender_id INTEGER NOT NULL, thread_id INTEGER NOT NULL, json TEXT NOT NULL, "
+        "PRIMARY KEY (chat_id, message_id));"
+        "CREATE INDEX IF NOT EXISTS messages_date ON messages (chat_id, date);";
+
+    const char *const UpsertSql =
+        "INSERT INTO messages (chat_id, message_id, date, edit_date, sender_id, thread_id, json) VALUES (?, ?, ?, ?, ?, ?, ?) "
+        "ON CONFLICT (chat_id, message_id) DO UPDATE SET date = excluded.date, edit_date = excluded.edit_date, "
+        "sender_id = excluded.sender_id, thread_id = excluded.thread_id, json = excluded.json "
+        "WHERE excluded.edit_date >= messages.edit_date";
+
+    const char *const DeleteSql = "DELETE FROM messages WHERE chat_id = ? AND message_id = ?";
+}
+
+
+TSqliteStore::TSqliteStore(const std::string &path, std::size_t batchRows)
+    : Path(path)
+    , BatchRows(batchRows)
+{
+}
+
+TSqliteStore::~TSqliteStore() {
+    std::string error;
+    if (!Finish(error))
+        std::cerr << "SQLite " << Path << ": " << error << std::endl;
+    sqlite3_finalize(Upsert);
+    sqlite3_finalize(Remove);
+    sqlite3_close(Db);
+}
+
+bool TSqliteStore::Open(std::string &error) {
+    if (sqlite3_open_v2(Path.c_str(), &Db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+        error = "Cannot open " + Path + ": " + (Db ? sqlite3_errmsg(Db) : "out of memory");
+        return false;
+    }
+    // WAL commits append to the log and sync only on checkpoints, readers are not blocked meanwhile
+    if (!Execute("PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL; PRAGMA cache_size = -65536;", error) || !Execute(Schema, error))
+        return false;
+    if (sqlite3_prepare_v2(Db, UpsertSql, -1, &Upsert, nullptr) != SQLITE_OK || sqlite3_prepare_v2(Db, DeleteSql, -1, &Remove, nullptr) != SQLITE_OK) {
+        error = std::string("Cannot prepare statements: ") + sqlite3_errmsg(Db);
+        return false;
+    }
+    return true;
+}
+
+bool TSqliteStore::Write(const TOutputPage &page, const std::vector<TStoredMessage> &rows, std::string &error) {
+    if (!Begin(error))
+        return false;
+    for (std::size_t i = 0; i < page.Records.size(); ++i) {
+        const TStoredMessage &row = rows[i];
+        Record.resize(page.GetRecordSize(i));
+        page.CopyRecord(i, &Record[0]);
+        sqlite3_bind_int64(Upsert, 1, row.ChatId);
+        sqlite3_bind_int64(Upsert, 2, row.MessageId);
+        sqlite3_bind_int(Upsert, 3, row.Date);
+        sqlite3_bind_int(Upsert, 4, row.EditDate);
+        sqlite3_bind_int64(Upsert, 5, row.SenderId);
+        sqlite3_bind_int64(Upsert, 6, row.ThreadId);
+        // The record outlives the step, so SQLite need not copy it
+        sqlite3_bind_text(Upsert, 7, Record.data(), static_cast<int>(Record.size()), SQLITE_STATIC);
+        const int result = sqlite3_step(Upsert);
+        sqlite3_reset(Upsert);
+        if (result != SQLITE_DONE) {
+            error = std::string("Cannot upsert message: ") + sqlite3_errmsg(Db);
+            return false;
+        }
+    }
+    TransactionRows += page.Records.size();
+    Rows += page.Records.size();
+    return TransactionRows < BatchRows || Finish(error);
+}
+
+bool TSqliteStore::Delete(long long chatId, const std::vector<std::int64_t> &messageIds, std::string &error) {
+    if (!Begin(error))
+        return false;
+    for (std::int64_t messageId : messageIds) {
+        sqlite3_bind_int64(Remove, 1, chatId);
+        sqlite3_bind_int64(Remove, 2, messageId);
+        const int result = sqlite3_step(Remove);
+        sqlite3_reset(Remove);
+        if (result != SQLITE_DONE) {
+            error = std::string("Cannot delete message: ") + sqlite3_errmsg(Db);
+            return false;
+        }
+    }
+    TransactionRows += messageIds.size();
+    return TransactionRows < BatchRows || Finish(error);
+}
+
+bool TSqliteStore::Finish(std::string &error) {
+    if (!InTransaction)
+        return true;
+    InTransaction = false;
+    TransactionRows = 0;
+    return Execute("COMMIT", error);
+}
+
+bool TSqliteStore::Begin(std::string &error) {
+    if (InTransaction)
+        return true;
+    InTransaction = Execute("BEGIN", error);
+    return InTransaction;
+}
+
+bool TSqliteStore::Execute(const char *sql, std::string &error) {
+    char *message = nullptr;
+    if (sqlite3_exec(Db, sql, nullptr, nullptr, &message) == SQLITE_OK)
+        return true;
+    error = std::string(sql, std::min<std::size_t>(strlen(sql), 32)) + ": " + (message ? message : "unknown error");
+    sqlite3_free(message);
+    return false;
+}
+
+#else
+
+TSqliteStore::TSqliteStore(const std::string &path, std::size_t batchRows)
+    : Path(path)
+    , BatchRows(batchRows)
+{
+}
+
+TSqliteStore::~TSqliteStore() {
+}
+
+bool TSqliteStore::Open(std::string &error) {
+    error = "the fetcher is built without SQLite";
+    return false;
+}
+
+bool TSqliteStore::Write(const TOutputPage &, const std::vector<TStoredMessage> &, std::string &error) {
+    error = "the fetcher is built without SQLite";
+    return false;
+}
+
+bool TSqliteStore::Delete(long long, const std::vector<std::int64_t> &, std::string &error) {
+    error = "the fetcher is built without SQLite";
+    return false;
+}
+
+bool TSqliteStore::Finish(std::string &) {
+    return true;
+}
+
+bool TSqliteStore::Begin(std::string &error) {
+    error = "the fetcher is built without SQLite";
+    return false;
+}
+
+bool TSqliteStore::Execute(const char *, std::string &error) {
+    error = "the fetcher is built without SQLite";
+    return false;
+}
+
+#endif
+
+std::size_t TSqliteStore::GetRowCount() const {
+    return Rows;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "output_page.h"
+
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+// Columns of a stored message besides its JSON
+struct TStoredMessage {
+    long long ChatId = 0;
+    long long MessageId = 0;
+    std::int32_t Date = 0;
+    std::int32_t EditDate = 0;
+    long long SenderId = 0;
+    long long ThreadId = 0;
+};
+
+// Upserts messages into the table messages of an SQLite database, keyed by (chat_id, message_id).
+// The database runs in WAL mode, rows are inserted by one prepared statement inside transactions of at
+// least batchRows rows. A row is overwritten by a version with the same or a later edit date, so
+// repeated exports update edited messages in place and leave the rest as is.
+// Without SQLite at build time Open fails.
+class TSqliteStore {
+    public:
+        TSqliteStore(const std::string &path, std::size_t batchRows = 10000);
+        ~TSqliteStore();
+
+        bool Open(std::string &error);
+        // Every record of the page, rows give the columns of the records in the same order
+        bool Write(const TOutputPage &page, const std::vector<TStoredMessage> &rows, std::string &error);
+        // Deletes the messages in the same transactions as upserts
+        bool Delete(long long chatId, const std::vector<std::int64_t> &messageIds, std::string &error);
+        // Commits the open transaction
+        bool Finish(std::string &error);
+        std::size_t GetRowCount() const;
+
+    private:
+        std::string Path;
+        std::size_t BatchRows;
+        sqlite3 *Db = nullptr;
+        sqlite3_stmt *Upsert = nullptr;
+        sqlite3_stmt *Remove = nullptr;
+        bool InTransaction = false;
+        std::size_t TransactionRows = 0;
+        std::size_t Rows = 0;
+        std::string Record;
+
+        TSqliteStore(const TSqliteStore &) = delete;
+        TSqliteStore &operator = (const TSqliteStore &) = delete;
+        TSqliteStore(TSqliteStore &&) = delete;
+        TSqliteStore &&operator = (TSqliteStore &&) = delete;
+
+        bool Begin(std::string &error);
+        bool Execute(const char *sql, std::string &error);
+};
@@ -0,0 +1,586 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <queue>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "media_store.h"
+#include "text_index.h"
+
+
+namespace {
+    const std::size_t MaxTokenLength = 64;
+
+    void AppendVarint(std::string &output, std::uint64_t value) {
+        while (value >= 0x80) {
+            output += static_cast<char>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        output += static_cast<char>(value);
+    }
+
+    bool ReadVarint(const char *&data, const char *end, std::uint64_t &value) {
+        value = 0;
+        for (int shift = 0; data != end && shift < 64; shift += 7) {
+            const unsigned char byte = static_cast<unsigned char>(*data++);
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    bool ReadVarint(std::istream &input, std::uint64_t &value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            const int byte = input.get();
+            if (byte == EOF)
+                return false;
+            value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    struct TPosting {
+        std::uint32_t Document = 0;
+        std::vector<std::uint32_t> Positions;
+    };
+
+    bool DecodePostings(const std::string &data, std::vector<TPosting> &postings) {
+        const char *begin = data.data();
+        const char *end = begin + data.size();
+        std::uint64_t document = 0;
+        while (begin != end) {
+            std::uint64_t delta = 0, count = 0;
+            if (!ReadVarint(begin, end, delta) || !ReadVarint(begin, end, count))
+                return false;
+            document += delta;
+            TPosting posting;
+            posting.Document = static_cast<std::uint32_t>(document);
+            std::uint64_t position = 0;
+            for (std::uint64_t i = 0; i < count; ++i) {
+                if (!ReadVarint(begin, end, delta))
+                    return false;
+                position += delta;
+                posting.Positions.push_back(static_cast<std::uint32_t>(position));
+            }
+            postings.push_back(std::move(posting));
+        }
+        return true;
+    }
+
+    void EncodePosting(std::string &output, std::uint32_t delta, const std::uint32_t *positions, std::size_t count) {
+        AppendVarint(output, delta);
+        AppendVarint(output, count);
+        std::uint32_t last = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            AppendVarint(output, positions[i] - last);
+            last = positions[i];
+        }
+    }
+
+    int CompareTokens(const TToken &lhs, const TToken &rhs) {
+        const int result = memcmp(lhs.Data, rhs.Data, std::min(lhs.Size, rhs.Size));
+        if (result != 0)
+            return result;
+        return lhs.Size < rhs.Size ? -1 : (lhs.Size > rhs.Size ? 1 : 0);
+    }
+
+    struct TDictionaryEntry {
+        std::string Term;
+        std::uint64_t DocumentCount = 0;
+        std::uint64_t Offset = 0;
+        std::uint64_t Length = 0;
+    };
+
+    void AppendDictionaryEntry(std::string &output, const TDictionaryEntry &entry) {
+        AppendVarint(output, entry.Term.size());
+        output += entry.Term;
+        AppendVarint(output, entry.DocumentCount);
+        AppendVarint(output, entry.Offset);
+        AppendVarint(output, entry.Length);
+    }
+
+    struct TDictionaryReader {
+        std::ifstream Input;
+        TDictionaryEntry Current;
+
+        explicit TDictionaryReader(const std::string &path)
+            : Input(path, std::ios::binary)
+        {
+        }
+
+        bool Next() {
+            std::uint64_t size = 0;
+            if (!ReadVarint(Input, size) || size > MaxTokenLength)
+                return false;
+            Current.Term.resize(size);
+            return Input.read(&Current.Term[0], size)
+                && ReadVarint(Input, Current.DocumentCount)
+                && ReadVarint(Input, Current.Offset)
+                && ReadVarint(Input, Current.Length);
+        }
+    };
+
+    bool ReadPostings(int fd, const TDictionaryEntry &entry, std::string &data) {
+        data.resize(entry.Length);
+        return pread(fd, &data[0], entry.Length, static_cast<off_t>(entry.Offset)) == static_cast<ssize_t>(entry.Length);
+    }
+
+    bool WriteFile(const std::string &path, const std::string &data) {
+        FILE *file = fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+        bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+        return fclose(file) == 0 && ok;
+    }
+
+    // Concatenates postings of segments covering consecutive document ranges, merging their dictionaries
+    bool MergeSegmentFiles(const std::string &directory, const std::vector<std::string> &inputs, const std::string &output, std::string &error) {
+        std::vector<std::unique_ptr<TDictionaryReader>> readers;
+        std::vector<int> postingFds;
+        bool ok = true;
+        for (const auto &input : inputs) {
+            readers.push_back(std::make_unique<TDictionaryReader>(directory + "/" + input + ".dict"));
+            postingFds.push_back(open((directory + "/" + input + ".post").c_str(), O_RDONLY));
+            if (!readers.back()->Input || postingFds.back() < 0) {
+                error = "Cannot read segment " + input;
+                ok = false;
+            }
+        }
+        FILE *postingsFile = ok ? fopen((directory + "/" + output + ".post").c_str(), "wb") : nullptr;
+        FILE *dictionaryFile = ok ? fopen((directory + "/" + output + ".dict").c_str(), "wb") : nullptr;
+        if (ok && (!postingsFile || !dictionaryFile)) {
+            error = "Cannot write segment " + output + ": " + strerror(errno);
+            ok = false;
+        }
+        if (ok) {
+            auto greater = [&readers](std::size_t lhs, std::size_t rhs) {
+                if (readers[lhs]->Current.Term != readers[rhs]->Current.Term)
+                    return readers[lhs]->Current.Term > readers[rhs]->Current.Term;
+                return lhs > rhs;
+            };
+            std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(greater)> heap(greater);
+            for (std::size_t i = 0; i < readers.size(); ++i)
+                if (readers[i]->Next())
+                    heap.push(i);
+            std::uint64_t offset = 0;
+            std::string data, merged, entryBuffer;
+            std::vector<TPosting> postings;
+            while (ok && !heap.empty()) {
+                TDictionaryEntry entry;
+                entry.Term = readers[heap.top()]->Current.Term;
+                entry.Offset = offset;
+                merged.clear();
+                std::uint32_t lastDocument = 0;
+                // Segments pop in input order for the same term, so documents stay ascending
+                while (ok && !heap.empty() && readers[heap.top()]->Current.Term == entry.Term) {
+                    const std::size_t i = heap.top();
+                    heap.pop();
+                    postings.clear();
+                    if (!ReadPostings(postingFds[i], readers[i]->Current, data) || !DecodePostings(data, postings)) {
+                        error = "Corrupted postings in segment " + inputs[i];
+                        ok = false;
+                        break;
+                    }
+                    for (const auto &posting : postings) {
+                        EncodePosting(merged, posting.Document - lastDocument, posting.Positions.data(), posting.Positions.size());
+                        lastDocument = posting.Document;
+                    }
+                    entry.DocumentCount += postings.size();
+                    if (readers[i]->Next())
+                        heap.push(i);
+                }
+                if (!ok)
+                    break;
+                entry.Length = merged.size();
+                offset += merged.size();
+                entryBuffer.clear();
+                AppendDictionaryEntry(entryBuffer, entry);
+                if (fwrite(merged.data(), 1, merged.size(), postingsFile) != merged.size()
+                    || fwrite(entryBuffer.data(), 1, entryBuffer.size(), dictionaryFile) != entryBuffer.size())
+                {
+                    error = "Cannot write segment " + output + ": " + strerror(errno);
+                    ok = false;
+                }
+            }
+        }
+        if (postingsFile && fclose(postingsFile) != 0 && ok) {
+            error = "Cannot write segment " + output + ": " + strerror(errno);
+            ok = false;
+        }
+        if (dictionaryFile && fclose(dictionaryFile) != 0 && ok) {
+            error = "Cannot write segment " + output + ": " + strerror(errno);
+            ok = false;
+        }
+        for (int fd : postingFds)
+            if (fd >= 0)
+                close(fd);
+        return ok;
+    }
+
+    std::vector<std::string> ReadSegmentNames(const std::string &directory, std::vector<std::size_t> *levels) {
+        std::vector<std::string> result;
+        std::ifstream fin(directory + "/segments");
+        std::string name;
+        std::size_t level = 0;
+        while (fin >> name >> level) {
+            result.push_back(name);
+            if (levels)
+                levels->push_back(level);
+        }
+        return result;
+    }
+}
+
+
+TArenaVector<TToken> TokenizeText(const std::string &text, TArena &arena) {
+    TArenaVector<TToken> result(arena);
+    // Folding keeps the length of every character, so the lowercase copy is as long as the text
+    char *lower = static_cast<char *>(arena.Allocate(text.size() + 1, 1));
+    std::size_t begin = 0;
+    std::size_t size = 0;
+    for (std::size_t i = 0; i <= text.size(); ++i) {
+        const unsigned char c = i < text.size() ? static_cast<unsigned char>(text[i]) : ' ';
+        if (c < 0x80 && std::isalnum(c)) {
+            lower[size++] = static_cast<char>(std::tolower(c));
+            continue;
+        }
+        if (c >= 0xC0 && c < 0xE0 && i + 1 < text.size() && (static_cast<unsigned char>(text[i + 1]) & 0xC0) == 0x80) {
+            // Capitals of Latin-1 and Cyrillic, the two byte scripts of most chats, are folded too
+            std::uint32_t code = ((c & 0x1F) << 6) | (static_cast<unsigned char>(text[++i]) & 0x3F);
+            if ((code >= 0xC0 && code <= 0xDE && code != 0xD7) || (code >= 0x410 && code <= 0x42F))
+                code += 0x20;
+            else if (code >= 0x400 && code <= 0x40F)
+                code += 0x50;
+            lower[size++] = static_cast<char>(0xC0 | (code >> 6));
+            lower[size++] = static_cast<char>(0x80 | (code & 0x3F));
+            continue;
+        }
+        if (c >= 0x80) {
+            lower[size++] = static_cast<char>(c);
+            continue;
+        }
+        // Overlong words are kept as their prefix, so a query for the same word still matches
+        if (size != begin)
+            result.push_back({lower + begin, std::min(size - begin, MaxTokenLength)});
+        begin = size;
+    }
+    return result;
+}
+
+
+TTextIndexWriter::TTextIndexWriter(const std::string &directory, std::size_t maxBufferedBytes)
+    : Directory(directory)
+    , MaxBufferedBytes(maxBufferedBytes)
+{
+    MakeDirectories(Directory);
+    LoadSegments();
+    Documents = fopen((Directory + "/docs.bin").c_str(), "ab");
+    if (!Documents)
+        Error = "Cannot write " + Directory + "/docs.bin: " + strerror(errno);
+    MergeThread = std::thread([this]() {
+        MergeLoop();
+    });
+}
+
+TTextIndexWriter::~TTextIndexWriter() {
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Stopping = true;
+    }
+    Condition.notify_all();
+    if (MergeThread.joinable())
+        MergeThread.join();
+    if (Documents)
+        fclose(Documents);
+}
+
+void TTextIndexWriter::LoadSegments() {
+    std::vector<std::size_t> levels;
+    auto names = ReadSegmentNames(Directory, &levels);
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        Segments.push_back({names[i], levels[i]});
+        std::size_t id = 0;
+        if (sscanf(names[i].c_str(), "seg_%zu", &id) == 1)
+            NextSegmentId = std::max(NextSegmentId, id + 1);
+    }
+    // A torn record at the tail is dropped, documents without a listed segment are simply never found
+    struct stat st;
+    if (stat((Directory + "/docs.bin").c_str(), &st) == 0) {
+        DocumentCount = static_cast<std::uint32_t>(st.st_size / sizeof(TMessageRef));
+        if (truncate((Directory + "/docs.bin").c_str(), DocumentCount * sizeof(TMessageRef)) != 0)
+            Error = "Cannot truncate " + Directory + "/docs.bin: " + strerror(errno);
+    }
+}
+
+std::string TTextIndexWriter::AllocateSegmentName() {
+    std::lock_guard<std::mutex> lock(Mutex);
+    char name[32];
+    snprintf(name, sizeof(name), "seg_%06zu", NextSegmentId++);
+    return name;
+}
+
+void TTextIndexWriter::Add(const TMessageRef &message, const std::string &text, TArena &arena) {
+    if (!Documents)
+        return;
+    auto tokens = TokenizeText(text, arena);
+    if (tokens.empty())
+        return;
+    const std::uint32_t document = DocumentCount++;
+    if (fwrite(&message, sizeof(message), 1, Documents) != 1)
+        Error = "Cannot write " + Directory + "/docs.bin: " + strerror(errno);
+    // Positions are token indices sorted by term, equal terms keep the order of the text
+    TArenaVector<std::uint32_t> positions(tokens.size(), 0, arena);
+    for (std::size_t i = 0; i < positions.size(); ++i)
+        positions[i] = static_cast<std::uint32_t>(i);
+    std::sort(positions.begin(), positions.end(), [&tokens](std::uint32_t lhs, std::uint32_t rhs) {
+        const int result = CompareTokens(tokens[lhs], tokens[rhs]);
+        return result < 0 || (result == 0 && lhs < rhs);
+    });
+    for (std::size_t begin = 0, end = 0; begin < positions.size(); begin = end) {
+        const TToken &token = tokens[positions[begin]];
+        for (end = begin + 1; end < positions.size() && CompareTokens(tokens[positions[end]], token) == 0; ++end) {
+        }
+        // The key buffer is reused, so known terms are looked up without allocating
+        TermKey.assign(token.Data, token.Size);
+        auto &postings = Postings[TermKey];
+        const std::size_t size = postings.Data.size();
+        EncodePosting(postings.Data, document - postings.LastDocument, positions.data() + begin, end - begin);
+        postings.LastDocument = document;
+        ++postings.DocumentCount;
+        BufferedBytes += postings.Data.size() - size + (size == 0 ? token.Size + sizeof(postings) : 0);
+    }
+    if (BufferedBytes >= MaxBufferedBytes && !Flush())
+        std::cerr << "Text index: " << Error << std::endl;
+}
+
+bool TTextIndexWriter::Flush() {
+    if (Postings.empty())
+        return true;
+    // Documents have to be on disk before a segment referencing them is listed
+    if (fflush(Documents) != 0) {
+        Error = "Cannot write " + Directory + "/docs.bin: " + strerror(errno);
+        return false;
+    }
+    std::vector<const std::pair<const std::string, TTermPostings> *> terms;
+    terms.reserve(Postings.size());
+    for (const auto &term : Postings)
+        terms.push_back(&term);
+    std::sort(terms.begin(), terms.end(), [](const auto *lhs, const auto *rhs) {
+        return lhs->first < rhs->first;
+    });
+    std::string postings, dictionary;
+    for (const auto *term : terms) {
+        TDictionaryEntry entry;
+        entry.Term = term->first;
+        entry.DocumentCount = term->second.DocumentCount;
+        entry.Offset = postings.size();
+        entry.Length = term->second.Data.size();
+        postings += term->second.Data;
+        AppendDictionaryEntry(dictionary, entry);
+    }
+    Postings.clear();
+    BufferedBytes = 0;
+    const std::string name = AllocateSegmentName();
+    if (!WriteFile(Directory + "/" + name + ".post", postings) || !WriteFile(Directory + "/" + name + ".dict", dictionary)) {
+        Error = "Cannot write segment " + name + ": " + strerror(errno);
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Segments.push_back({name, 0});
+        std::string error;
+        if (!WriteSegmentList(error)) {
+            Error = error;
+            return false;
+        }
+    }
+    Condition.notify_all();
+    return true;
+}
+
+bool TTextIndexWriter::WriteSegmentList(std::string &error) {
+    std::string data;
+    for (const auto &segment : Segments)
+        data += segment.Name + " " + std::to_string(segment.Level) + "\n";
+    const std::string path = Directory + "/segments";
+    if (!WriteFile(path + ".tmp", data) || rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+        error = "Cannot write " + path + ": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool TTextIndexWriter::FindMerge(std::size_t &begin) const {
+    if (MergeFailed)
+        return false;
+    for (begin = 0; begin + MergeFactor <= Segments.size(); ++begin) {
+        std::size_t end = begin + 1;
+        while (end < Segments.size() && end - begin < MergeFactor && Segments[end].Level == Segments[begin].Level)
+            ++end;
+        if (end - begin == MergeFactor)
+            return true;
+    }
+    return false;
+}
+
+void TTextIndexWriter::MergeLoop() {
+    std::unique_lock<std::mutex> lock(Mutex);
+    while (true) {
+        std::size_t begin = 0;
+        Condition.wait(lock, [this, &begin]() {
+            return Stopping || FindMerge(begin);
+        });
+        if (!FindMerge(begin)) {
+            if (Stopping)
+                return;
+            continue;
+        }
+        std::vector<std::string> inputs;
+        for (std::size_t i = begin; i < begin + MergeFactor; ++i)
+            inputs.push_back(Segments[i].Name);
+        const std::size_t level = Segments[begin].Level + 1;
+        char name[32];
+        snprintf(name, sizeof(name), "seg_%06zu", NextSegmentId++);
+        lock.unlock();
+        std::string error;
+        const bool ok = MergeSegmentFiles(Directory, inputs, name, error);
+        lock.lock();
+        if (!ok) {
+            MergeFailed = true;
+            MergeError = error;
+            unlink((Directory + "/" + name + ".post").c_str());
+            unlink((Directory + "/" + name + ".dict").c_str());
+            continue;
+        }
+        // Only this thread removes segments and new ones are appended, so the merged range has not moved
+        Segments.erase(Segments.begin() + begin, Segments.begin() + begin + MergeFactor);
+        Segments.insert(Segments.begin() + begin, TSegment{name, level});
+        if (!WriteSegmentList(error)) {
+            MergeFailed = true;
+            MergeError = error;
+            continue;
+        }
+        for (const auto &input : inputs) {
+            unlink((Directory + "/" + input + ".post").c_str());
+            unlink((Directory + "/" + input + ".dict").c_str());
+        }
+    }
+}
+
+bool TTextIndexWriter::Finish(std::string &error) {
+    // Buffered postings are written even after an earlier failure, the index is reported as incomplete anyway
+    bool ok = Flush() && Error.empty();
+    {
+        std::lock_guard<std::mutex> lock(Mutex);
+        Stopping = true;
+    }
+    Condition.notify_all();
+    if (MergeThread.joinable())
+        MergeThread.join();
+    if (ok && MergeFailed) {
+        Error = MergeError;
+        ok = false;
+    }
+    if (!ok)
+        error = Error;
+    return ok;
+}
+
+
+int RunTextSearch(int argc, char **argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: fetcher search <index_dir> <words>..." << std::endl;
+        return 1;
+    }
+    const std::string directory = argv[1];
+    std::vector<std::vector<std::string>> clauses;
+    std::set<std::string> terms;
+    TArena arena;
+    for (int i = 2; i < argc; ++i) {
+        std::vector<std::string> clause;
+        for (const auto &token : TokenizeText(argv[i], arena))
+            clause.emplace_back(token.Data, token.Size);
+        if (clause.empty())
+            continue;
+        terms.insert(clause.begin(), clause.end());
+        clauses.push_back(std::move(clause));
+    }
+    if (clauses.empty())
+        return 0;
+    const int documentsFd = open((directory + "/docs.bin").c_str(), O_RDONLY);
+    if (documentsFd < 0) {
+        std::cerr << "Cannot open text index in " << directory << std::endl;
+        return 1;
+    }
+    std::set<std::pair<std::int64_t, std::int64_t>> printed;
+    for (const auto &segment : ReadSegmentNames(directory, nullptr)) {
+        // Postings of the query terms only, the dictionary is streamed once
+        std::map<std::string, std::vector<TPosting>> postings;
+        TDictionaryReader dictionary(directory + "/" + segment + ".dict");
+        const int postingsFd = open((directory + "/" + segment + ".post").c_str(), O_RDONLY);
+        std::string data;
+        while (postingsFd >= 0 && dictionary.Next()) {
+            if (terms.count(dictionary.Current.Term) && ReadPostings(postingsFd, dictionary.Current, data))
+                DecodePostings(data, postings[dictionary.Current.Term]);
+        }
+        if (postingsFd >= 0)
+            close(postingsFd);
+        std::set<std::uint32_t> matches;
+        bool first = true;
+        for (const auto &clause : clauses) {
+            // Document -> positions where the phrase may start
+            std::map<std::uint32_t, std::vector<std::uint32_t>> starts;
+            for (const auto &posting : postings[clause[0]])
+                starts[posting.Document] = posting.Positions;
+            for (std::size_t i = 1; i < clause.size() && !starts.empty(); ++i) {
+                std::map<std::uint32_t, std::vector<std::uint32_t>> next;
+                for (const auto &posting : postings[clause[i]]) {
+                    auto it = starts.find(posting.Document);
+                    if (it == starts.end())
+                        continue;
+                    std::vector<std::uint32_t> kept;
+                    for (std::uint32_t start : it->second)
+                        if (std::binary_search(posting.Positions.begin(), posting.Positions.end(), static_cast<std::uint32_t>(start + i)))
+                            kept.push_back(start);
+                    if (!kept.empty())
+                        next[posting.Document] = std::move(kept);
+                }
+                starts.swap(next);
+            }
+            std::set<std::uint32_t> clauseMatches;
+            for (const auto &start : starts)
+                if (first || matches.count(start.first))
+                    clauseMatches.insert(start.first);
+            matches.swap(clauseMatches);
+            first = false;
+        }
+        for (std::uint32_t document : matches) {
+            TMessageRef message;
+            const off_t offset = static_cast<off_t>(document) * sizeof(message);
+            if (pread(documentsFd, &message, sizeof(message), offset) != static_cast<ssize_t>(sizeof(message)))
+                continue;
+            // The same message indexed by several exports is printed once
+            if (printed.insert({message.ChatId, message.MessageId}).second)
+                std::cout << message.ChatId << ' ' << message.MessageId << '\n';
+        }
+    }
+    close(documentsFd);
+    return 0;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.h"
+#include "reply_index.h"
+
+
+// Word of a text, pointing into a lowercase copy kept in the arena
+struct TToken {
+    const char *Data;
+    std::size_t Size;
+};
+
+// Splits text into lowercase words: runs of ASCII letters and digits and of non-ASCII UTF-8 characters
+TArenaVector<TToken> TokenizeText(const std::string &text, TArena &arena);
+
+// Inverted index of message texts, built in the same pass as the export.
+// Every message gets a document number, docs.bin maps numbers to messages.
+// Postings are collected in memory and flushed into immutable segments: seg_N.dict keeps sorted terms,
+// seg_N.post their postings as varints of document deltas, position counts and position deltas.
+// A background thread merges runs of MergeFactor segments of the same level into one segment of the next
+// level, the segments file lists live segments and is replaced atomically after every change.
+// Indexing into an existing directory continues it.
+class TTextIndexWriter {
+    public:
+        TTextIndexWriter(const std::string &directory, std::size_t maxBufferedBytes = 64 << 20);
+        ~TTextIndexWriter();
+
+        // Temporaries of the message are taken from the arena
+        void Add(const TMessageRef &message, const std::string &text, TArena &arena);
+        // Flushes buffered postings and waits for pending merges, returns false and fills error on failure
+        bool Finish(std::string &error);
+
+    private:
+        struct TTermPostings {
+            std::string Data;
+            std::uint32_t LastDocument = 0;
+            std::uint32_t DocumentCount = 0;
+        };
+        struct TSegment {
+            std::string Name;
+            std::size_t Level = 0;
+        };
+        static const std::size_t MergeFactor = 8;
+
+        std::string Directory;
+        std::size_t MaxBufferedBytes;
+        FILE *Documents = nullptr;
+        std::uint32_t DocumentCount = 0;
+        std::unordered_map<std::string, TTermPostings> Postings;
+        std::size_t BufferedBytes = 0;
+        std::string TermKey;
+        // Failures of the exporting thread, the merge thread reports through MergeError
+        std::string Error;
+
+        // Guards everything below, segments are only removed by the merge thread
+        std::mutex Mutex;
+        std::condition_variable Condition;
+        std::vector<TSegment> Segments;
+        std::size_t NextSegmentId = 0;
+        bool Stopping = false;
+        bool MergeFailed = false;
+        std::string MergeError;
+        std::thread MergeThread;
+
+        TTextIndexWriter(const TTextIndexWriter &) = delete;
+        TTextIndexWriter &operator = (const TTextIndexWriter &) = delete;
+        TTextIndexWriter(TTextIndexWriter &&) = delete;
+        TTextIndexWriter &&operator = (TTextIndexWriter &&) = delete;
+
+        void LoadSegments();
+        std::string AllocateSegmentName();
+        bool Flush();
+        // Called with the mutex held from both threads, so the error goes to the caller rather than to Error
+        bool WriteSegmentList(std::string &error);
+        bool FindMerge(std::size_t &begin) const;
+        void MergeLoop();
+};
+
+// "fetcher search DIR CLAUSE...", prints messages matching every clause, a clause of several words is a phrase
+int RunTextSearch(int argc, char **argv);
@@ -0,0 +1,152 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "utf8.h"
+#include "utf8_simd.h"
+
+
+namespace {
+    // Bounds of the second byte of a sequence with the given lead, false for bytes which never lead
+    bool GetSequenceBounds(unsigned char lead, std::size_t &length, unsigned char &min, unsigned char &max) {
+        min = 0x80;
+        max = 0xBF;
+        if (lead >= 0xC2 && lead <= 0xDF) {
+            length = 2;
+        } else if (lead >= 0xE0 && lead <= 0xEF) {
+            length = 3;
+            if (lead == 0xE0)
+                min = 0xA0;
+            else if (lead == 0xED)
+                max = 0x9F;
+        } else if (lead >= 0xF0 && lead <= 0xF4) {
+            length = 4;
+            if (lead == 0xF0)
+                min = 0x90;
+            else if (lead == 0xF4)
+                max = 0x8F;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    // Length of the longest prefix at data which may still become a valid sequence, at least 1
+    std::size_t GetInvalidSubpartLength(const unsigned char *data, std::size_t size) {
+        std::size_t length = 0;
+        unsigned char min = 0, max = 0;
+        if (!GetSequenceBounds(data[0], length, min, max))
+            return 1;
+        std::size_t i = 1;
+        if (i < size && data[i] >= min && data[i] <= max) {
+            ++i;
+            while (i < length && i < size && (data[i] & 0xC0) == 0x80)
+                ++i;
+        }
+        return i;
+    }
+
+    using TValidateFunction = bool (*)(const char *data, std::size_t size);
+
+#if defined(__SSE2__)
+    using namespace detail;
+
+    __attribute__((target("ssse3"))) bool IsValidUtf8Ssse3(const char *data, std::size_t size) {
+        __m128i previous = _mm_setzero_si128();
+        __m128i previousIncomplete = _mm_setzero_si128();
+        __m128i error = _mm_setzero_si128();
+        std::size_t i = 0;
+        for (; i + 16 <= size; i += 16)
+            CheckBlockSsse3(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i)), previous, previousIncomplete, error);
+        if (i < size) {
+            // Zero padding is ASCII, so a sequence cut by the end is reported as too short
+            alignas(16) char tail[16] = {};
+            memcpy(tail, data + i, size - i);
+            CheckBlockSsse3(_mm_load_si128(reinterpret_cast<const __m128i *>(tail)), previous, previousIncomplete, error);
+        }
+        error = _mm_or_si128(error, previousIncomplete);
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+    }
+
+    __attribute__((target("avx2"))) bool IsValidUtf8Avx2(const char *data, std::size_t size) {
+        __m256i previous = _mm256_setzero_si256();
+        __m256i previousIncomplete = _mm256_setzero_si256();
+        __m256i error = _mm256_setzero_si256();
+        std::size_t i = 0;
+        for (; i + 32 <= size; i += 32)
+            CheckBlockAvx2(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)), previous, previousIncomplete, error);
+        if (i < size) {
+            alignas(32) char tail[32] = {};
+            memcpy(tail, data + i, size - i);
+            CheckBlockAvx2(_mm256_load_si256(reinterpret_cast<const __m256i *>(tail)), previous, previousIncomplete, error);
+        }
+        error = _mm256_or_si256(error, previousIncomplete);
+        return _mm256_testz_si256(error, error) != 0;
+    }
+#endif
+
+    TValidateFunction SelectValidate() {
+#if defined(__SSE2__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return IsValidUtf8Avx2;
+        if (__builtin_cpu_supports("ssse3"))
+            return IsValidUtf8Ssse3;
+#endif
+        return IsValidUtf8Scalar;
+    }
+}
+
+
+std::size_t GetUtf8SequenceLength(const char *data, std::size_t size) {
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    std::size_t length = 0;
+    unsigned char min = 0, max = 0;
+    if (!GetSequenceBounds(bytes[0], length, min, max))
+        return 0;
+    if (size < length || bytes[1] < min || bytes[1] > max)
+        return 0;
+    for (std::size_t i = 2; i < length; ++i)
+        if ((bytes[i] & 0xC0) != 0x80)
+            return 0;
+    return length;
+}
+
+bool IsValidUtf8(const char *data, std::size_t size) {
+    static const TValidateFunction validate = SelectValidate();
+    return validate(data, size);
+}
+
+bool IsValidUtf8Scalar(const char *data, std::size_t size) {
+    for (std::size_t i = 0; i < size;) {
+        if (static_cast<unsigned char>(data[i]) < 0x80) {
+            ++i;
+            continue;
+        }
+        const std::size_t length = GetUtf8SequenceLength(data + i, size - i);
+        if (length == 0)
+            return false;
+        i += length;
+    }
+    return true;
+}
+
+void RepairUtf8(const char *data, std::size_t size, std::string &output) {
+    std::size_t begin = 0;
+    for (std::size_t i = 0; i < size;) {
+        if (static_cast<unsigned char>(data[i]) < 0x80) {
+            ++i;
+            continue;
+        }
+        std::size_t length = GetUtf8SequenceLength(data + i, size - i);
+        if (length != 0) {
+            i += length;
+            continue;
+        }
+        output.append(data + begin, i - begin);
+        output += "\xEF\xBF\xBD";
+        i += GetInvalidSubpartLength(reinterpret_cast<const unsigned char *>(data) + i, size - i);
+        begin = i;
+    }
+    output.append(data + begin, size - begin);
+}
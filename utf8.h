@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+
+// Length of the valid UTF-8 sequence at data, 0 when it is malformed, overlong, a surrogate or beyond U+10FFFF
+std::size_t GetUtf8SequenceLength(const char *data, std::size_t size);
+// Validates 32 (AVX2) or 16 (SSSE3) bytes at a time with the lookup algorithm of Keiser and Lemire
+bool IsValidUtf8(const char *data, std::size_t size);
+// Byte at a time reference implementation
+bool IsValidUtf8Scalar(const char *data, std::size_t size);
+// Appends the string replacing every maximal invalid subpart with U+FFFD
+void RepairUtf8(const char *data, std::size_t size, std::string &output);
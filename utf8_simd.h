@@ -0,0 +1,133 @@
+#pragma once
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <cstdint>
+
+
+// Block steps of the Keiser-Lemire UTF-8 validation, shared by the validator and the JSON escaper.
+// A block is checked against the previous one, errors accumulate until the end of the input.
+namespace detail {
+    // Error bits of the lookup tables, a pair of bytes is invalid when the three lookups share a bit
+    enum : std::uint8_t {
+        TooShort = 1 << 0,
+        TooLong = 1 << 1,
+        Overlong3 = 1 << 2,
+        TooLarge = 1 << 3,
+        Surrogate = 1 << 4,
+        Overlong2 = 1 << 5,
+        TooLarge1000 = 1 << 6,
+        Overlong4 = 1 << 6,
+        TwoContinuations = 1 << 7,
+        Carry = TooShort | TooLong | TwoContinuations
+    };
+
+    // Indexed by the high nibble of the first byte of a pair
+    alignas(16) const std::uint8_t FirstHighTable[16] = {
+        TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong,
+        TwoContinuations, TwoContinuations, TwoContinuations, TwoContinuations,
+        TooShort | Overlong2,
+        TooShort,
+        TooShort | Overlong3 | Surrogate,
+        TooShort | TooLarge | TooLarge1000 | Overlong4
+    };
+    // Indexed by the low nibble of the first byte of a pair
+    alignas(16) const std::uint8_t FirstLowTable[16] = {
+        Carry | Overlong3 | Overlong2 | Overlong4,
+        Carry | Overlong2,
+        Carry,
+        Carry,
+        Carry | TooLarge,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000 | Surrogate,
+        Carry | TooLarge | TooLarge1000,
+        Carry | TooLarge | TooLarge1000
+    };
+    // Indexed by the high nibble of the second byte of a pair
+    alignas(16) const std::uint8_t SecondHighTable[16] = {
+        TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort,
+        TooLong | Overlong2 | TwoContinuations | Overlong3 | TooLarge1000 | Overlong4,
+        TooLong | Overlong2 | TwoContinuations | Overlong3 | TooLarge,
+        TooLong | Overlong2 | TwoContinuations | Surrogate | TooLarge,
+        TooLong | Overlong2 | TwoContinuations | Surrogate | TooLarge,
+        TooShort, TooShort, TooShort, TooShort
+    };
+    // Largest bytes which do not start a sequence running past the end of a block
+    alignas(32) const std::uint8_t IncompleteBounds[32] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xEF, 0xDF, 0xBF
+    };
+
+#if defined(__SSE2__)
+    __attribute__((target("ssse3"))) inline __m128i HighNibbles(__m128i value) {
+        return _mm_and_si128(_mm_srli_epi16(value, 4), _mm_set1_epi8(0x0F));
+    }
+
+    __attribute__((target("ssse3"))) inline void CheckBlockSsse3(__m128i input, __m128i &previous, __m128i &previousIncomplete, __m128i &error) {
+        if (_mm_movemask_epi8(input) == 0) {
+            error = _mm_or_si128(error, previousIncomplete);
+            previous = input;
+            previousIncomplete = _mm_setzero_si128();
+            return;
+        }
+        const __m128i previous1 = _mm_alignr_epi8(input, previous, 15);
+        const __m128i special = _mm_and_si128(
+            _mm_and_si128(
+                _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i *>(FirstHighTable)), HighNibbles(previous1)),
+                _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i *>(FirstLowTable)), _mm_and_si128(previous1, _mm_set1_epi8(0x0F)))
+            ),
+            _mm_shuffle_epi8(_mm_load_si128(reinterpret_cast<const __m128i *>(SecondHighTable)), HighNibbles(input))
+        );
+        // Third and fourth bytes of a sequence must be continuations, which the pair tables flag as errors
+        const __m128i third = _mm_subs_epu8(_mm_alignr_epi8(input, previous, 14), _mm_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+        const __m128i fourth = _mm_subs_epu8(_mm_alignr_epi8(input, previous, 13), _mm_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+        const __m128i continuation = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(static_cast<char>(0x80)));
+        error = _mm_or_si128(error, _mm_xor_si128(continuation, special));
+        previousIncomplete = _mm_subs_epu8(input, _mm_loadu_si128(reinterpret_cast<const __m128i *>(IncompleteBounds + 16)));
+        previous = input;
+    }
+
+    __attribute__((target("avx2"))) inline __m256i HighNibbles(__m256i value) {
+        return _mm256_and_si256(_mm256_srli_epi16(value, 4), _mm256_set1_epi8(0x0F));
+    }
+
+    __attribute__((target("avx2"))) inline __m256i LoadTable(const std::uint8_t *table) {
+        return _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i *>(table)));
+    }
+
+    __attribute__((target("avx2"))) inline void CheckBlockAvx2(__m256i input, __m256i &previous, __m256i &previousIncomplete, __m256i &error) {
+        if (_mm256_movemask_epi8(input) == 0) {
+            error = _mm256_or_si256(error, previousIncomplete);
+            previous = input;
+            previousIncomplete = _mm256_setzero_si256();
+            return;
+        }
+        // Bytes shifted across the lane boundary: the high lane of the previous block goes before the low lane of this one
+        const __m256i carried = _mm256_permute2x128_si256(previous, input, 0x21);
+        const __m256i previous1 = _mm256_alignr_epi8(input, carried, 15);
+        const __m256i special = _mm256_and_si256(
+            _mm256_and_si256(
+                _mm256_shuffle_epi8(LoadTable(FirstHighTable), HighNibbles(previous1)),
+                _mm256_shuffle_epi8(LoadTable(FirstLowTable), _mm256_and_si256(previous1, _mm256_set1_epi8(0x0F)))
+            ),
+            _mm256_shuffle_epi8(LoadTable(SecondHighTable), HighNibbles(input))
+        );
+        const __m256i third = _mm256_subs_epu8(_mm256_alignr_epi8(input, carried, 14), _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+        const __m256i fourth = _mm256_subs_epu8(_mm256_alignr_epi8(input, carried, 13), _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+        const __m256i continuation = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(static_cast<char>(0x80)));
+        error = _mm256_or_si256(error, _mm256_xor_si256(continuation, special));
+        previousIncomplete = _mm256_subs_epu8(input, _mm256_load_si256(reinterpret_cast<const __m256i *>(IncompleteBounds)));
+        previous = input;
+    }
+
+#endif
+}  // namespace detail